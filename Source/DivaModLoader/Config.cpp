@@ -2,7 +2,9 @@
 
 bool Config::enableDebugConsole;
 std::string Config::modsDirectoryPath;
+std::string Config::cacheDirectoryPath;
 std::vector<std::string> Config::priorityPaths;
+uint32_t Config::movieDecodeThreads;
 
 bool Config::init()
 {
@@ -24,6 +26,8 @@ bool Config::init()
 
     enableDebugConsole = config["console"].value_or(false);
     modsDirectoryPath = config["mods"].value_or("mods");
+    cacheDirectoryPath = std::filesystem::absolute(config["cache"].value_or("cache")).string();
+    movieDecodeThreads = config["movie_decode_threads"].value_or(0u);
 
     if (toml::array* priorityArr = config["priority"].as_array())
     {
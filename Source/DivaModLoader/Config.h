@@ -5,7 +5,9 @@ class Config
 public:
     static bool enableDebugConsole;
     static std::string modsDirectoryPath;
+    static std::string cacheDirectoryPath;
     static std::vector<std::string> priorityPaths;
+    static uint32_t movieDecodeThreads;
 
     static bool init();
 };
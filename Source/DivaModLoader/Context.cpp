@@ -59,7 +59,12 @@ HOOK(int, WINAPI, WinMain, readInstrPtr(sigWinMain(), 0, 0x5), HINSTANCE hInstan
 {
     Context::postInit();
 
-    return originalWinMain(hInstance, hPrevInstance, lpCmdLine, nShowCmd);
+    const int result = originalWinMain(hInstance, hPrevInstance, lpCmdLine, nShowCmd);
+
+    // The process exits right after this, which would kill the save writer in the middle of a write.
+    SaveData::flush();
+
+    return result;
 }
 
 void Context::preInit()
@@ -95,6 +100,7 @@ void Context::init()
 
     Patches::init();
     ModLoader::init();
+    PvLoader::preInit();
     CodeLoader::init();
     FileLoader::init();
     SaveData::init();
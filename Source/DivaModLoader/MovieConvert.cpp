@@ -0,0 +1,219 @@
+#include "MovieConvert.h"
+
+#include <immintrin.h>
+#include <intrin.h>
+
+// Frames at least this large get their rows split across threads.
+constexpr int32_t PARALLEL_MIN_PIXELS = 3840 * 2160;
+constexpr size_t PARALLEL_MAX_BANDS = 4;
+
+static bool
+has_avx2() {
+    int32_t info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+
+    // The OS has to save the YMM registers too, not just the CPU support them.
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return false;
+    if ((_xgetbv(0) & 6) != 6) return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+
+static const bool avx2 = has_avx2();
+
+static void
+copy_luma_row_10(const uint16_t* src, uint16_t* dst, int32_t width) {
+    int32_t i = 0;
+    if (avx2) {
+        for (; i + 16 <= width; i += 16) {
+            __m256i data = _mm256_loadu_si256((const __m256i*)(src + i));
+            _mm256_storeu_si256((__m256i*)(dst + i), _mm256_slli_epi16(data, 6));
+        }
+    }
+    for (; i + 8 <= width; i += 8) {
+        __m128i data = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_slli_epi16(data, 6));
+    }
+    for (; i < width; i++) dst[i] = (uint16_t)(src[i] << 6);
+}
+
+static void
+interleave_chroma_row_8(const uint8_t* u, const uint8_t* v, uint8_t* dst, int32_t width) {
+    int32_t i = 0;
+    if (avx2) {
+        for (; i + 32 <= width; i += 32) {
+            __m256i u_data = _mm256_loadu_si256((const __m256i*)(u + i));
+            __m256i v_data = _mm256_loadu_si256((const __m256i*)(v + i));
+
+            // Unpacking works per 128-bit lane, so the halves have to be put back in order.
+            __m256i lo = _mm256_unpacklo_epi8(u_data, v_data);
+            __m256i hi = _mm256_unpackhi_epi8(u_data, v_data);
+            _mm256_storeu_si256((__m256i*)(dst + i * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256((__m256i*)(dst + i * 2 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+        }
+    }
+    for (; i + 16 <= width; i += 16) {
+        __m128i u_data = _mm_loadu_si128((const __m128i*)(u + i));
+        __m128i v_data = _mm_loadu_si128((const __m128i*)(v + i));
+        _mm_storeu_si128((__m128i*)(dst + i * 2), _mm_unpacklo_epi8(u_data, v_data));
+        _mm_storeu_si128((__m128i*)(dst + i * 2 + 16), _mm_unpackhi_epi8(u_data, v_data));
+    }
+    for (; i < width; i++) {
+        dst[i * 2] = u[i];
+        dst[i * 2 + 1] = v[i];
+    }
+}
+
+static void
+interleave_chroma_row_10(const uint16_t* u, const uint16_t* v, uint16_t* dst, int32_t width) {
+    int32_t i = 0;
+    if (avx2) {
+        for (; i + 16 <= width; i += 16) {
+            __m256i u_data = _mm256_slli_epi16(_mm256_loadu_si256((const __m256i*)(u + i)), 6);
+            __m256i v_data = _mm256_slli_epi16(_mm256_loadu_si256((const __m256i*)(v + i)), 6);
+
+            __m256i lo = _mm256_unpacklo_epi16(u_data, v_data);
+            __m256i hi = _mm256_unpackhi_epi16(u_data, v_data);
+            _mm256_storeu_si256((__m256i*)(dst + i * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256((__m256i*)(dst + i * 2 + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+        }
+    }
+    for (; i + 8 <= width; i += 8) {
+        __m128i u_data = _mm_slli_epi16(_mm_loadu_si128((const __m128i*)(u + i)), 6);
+        __m128i v_data = _mm_slli_epi16(_mm_loadu_si128((const __m128i*)(v + i)), 6);
+        _mm_storeu_si128((__m128i*)(dst + i * 2), _mm_unpacklo_epi16(u_data, v_data));
+        _mm_storeu_si128((__m128i*)(dst + i * 2 + 8), _mm_unpackhi_epi16(u_data, v_data));
+    }
+    for (; i < width; i++) {
+        dst[i * 2] = (uint16_t)(u[i] << 6);
+        dst[i * 2 + 1] = (uint16_t)(v[i] << 6);
+    }
+}
+
+// Workers converting the other bands of a frame while the calling thread does the first one. They're
+// started once and then wait between frames, as starting threads every frame would take up a good part
+// of the time saved. They're never joined and simply go away with the process.
+struct ConvertPool {
+    std::mutex run_mutex;
+    std::mutex mutex;
+    std::condition_variable start_cond;
+    std::condition_variable done_cond;
+    const std::function<void(size_t)>* job;
+    size_t job_bands;
+    uint64_t job_id;
+    size_t pending;
+    size_t workers;
+
+    ConvertPool() {
+        this->job = nullptr;
+        this->job_bands = 0;
+        this->job_id = 0;
+        this->pending = 0;
+        this->workers = 0;
+    }
+
+    void Worker(size_t band) {
+        uint64_t last_job_id = 0;
+        while (true) {
+            const std::function<void(size_t)>* job;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->start_cond.wait(lock, [&] { return this->job_id != last_job_id; });
+                last_job_id = this->job_id;
+                if (band >= this->job_bands) continue;
+                job = this->job;
+            }
+
+            (*job)(band);
+
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (--this->pending != 0) continue;
+            }
+            this->done_cond.notify_one();
+        }
+    }
+
+    void Run(size_t bands, const std::function<void(size_t)>& function) {
+        std::lock_guard<std::mutex> run_lock(this->run_mutex);
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            for (; this->workers < bands - 1; this->workers++)
+                std::thread(&ConvertPool::Worker, this, this->workers + 1).detach();
+
+            this->job = &function;
+            this->job_bands = bands;
+            this->pending = bands - 1;
+            this->job_id++;
+        }
+        this->start_cond.notify_all();
+
+        function(0);
+
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->done_cond.wait(lock, [this] { return this->pending == 0; });
+    }
+};
+
+// Calls convert_row_pair for ranges of chroma rows, which also covers the two luma rows of each.
+template<typename T>
+static void
+convert_rows(const T& convert_row_pair, int32_t chroma_height, int32_t width, int32_t height) {
+    size_t bands = 1;
+    if (width * height >= PARALLEL_MIN_PIXELS)
+        bands = std::min<size_t>(PARALLEL_MAX_BANDS, std::max(1u, std::thread::hardware_concurrency()));
+
+    if (bands == 1) {
+        convert_row_pair(0, chroma_height);
+        return;
+    }
+
+    // Never destroyed, so that exiting doesn't wait on or tear down the detached workers.
+    static ConvertPool* pool = new ConvertPool();
+    pool->Run(bands, [&](size_t band) {
+        convert_row_pair((int32_t)(band * chroma_height / bands), (int32_t)((band + 1) * chroma_height / bands));
+    });
+}
+
+void
+MovieConvert::yuv420p_to_nv12(const uint8_t* const data[3], const int32_t linesize[3], int32_t width, int32_t height, uint8_t* dst, uint32_t pitch) {
+    uint8_t* chroma_dst = dst + (size_t)height * pitch;
+
+    convert_rows([&](int32_t begin, int32_t end) {
+        int32_t luma_end = std::min(end * 2, height);
+        if (linesize[0] == (int32_t)pitch) {
+            memcpy(dst + (size_t)begin * 2 * pitch, data[0] + (size_t)begin * 2 * pitch, (size_t)(luma_end - begin * 2) * pitch);
+        }
+        else {
+            for (int32_t i = begin * 2; i < luma_end; i++)
+                memcpy(dst + (size_t)i * pitch, data[0] + (ptrdiff_t)i * linesize[0], width);
+        }
+
+        for (int32_t i = begin; i < end; i++)
+            interleave_chroma_row_8(data[1] + (ptrdiff_t)i * linesize[1], data[2] + (ptrdiff_t)i * linesize[2], chroma_dst + (size_t)i * pitch, (width + 1) / 2);
+    }, (height + 1) / 2, width, height);
+}
+
+void
+MovieConvert::yuv420p10_to_p010(const uint8_t* const data[3], const int32_t linesize[3], int32_t width, int32_t height, uint8_t* dst, uint32_t pitch) {
+    uint8_t* chroma_dst = dst + (size_t)height * pitch;
+
+    convert_rows([&](int32_t begin, int32_t end) {
+        int32_t luma_end = std::min(end * 2, height);
+        if (linesize[0] == (int32_t)pitch) {
+            copy_luma_row_10((const uint16_t*)(data[0] + (size_t)begin * 2 * pitch), (uint16_t*)(dst + (size_t)begin * 2 * pitch), (int32_t)((size_t)(luma_end - begin * 2) * pitch / 2));
+        }
+        else {
+            for (int32_t i = begin * 2; i < luma_end; i++)
+                copy_luma_row_10((const uint16_t*)(data[0] + (ptrdiff_t)i * linesize[0]), (uint16_t*)(dst + (size_t)i * pitch), width);
+        }
+
+        for (int32_t i = begin; i < end; i++) {
+            interleave_chroma_row_10((const uint16_t*)(data[1] + (ptrdiff_t)i * linesize[1]), (const uint16_t*)(data[2] + (ptrdiff_t)i * linesize[2]),
+                (uint16_t*)(chroma_dst + (size_t)i * pitch), (width + 1) / 2);
+        }
+    }, (height + 1) / 2, width, height);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+// Converts planar 4:2:0 frames into the NV12/P010 layout of the staging texture, where the
+// interleaved chroma plane starts right after the last luma row. Luma planes whose linesize
+// already matches the pitch are copied in one go.
+struct MovieConvert {
+    static void yuv420p_to_nv12(const uint8_t* const data[3], const int32_t linesize[3], int32_t width, int32_t height, uint8_t* dst, uint32_t pitch);
+    static void yuv420p10_to_p010(const uint8_t* const data[3], const int32_t linesize[3], int32_t width, int32_t height, uint8_t* dst, uint32_t pitch);
+};
@@ -1,4 +1,5 @@
 #include "MoviePlayer.h"
+#include "MovieConvert.h"
 #include "MoviePlayer_vs.fxh";
 #include "MoviePlayer_bt601_full.fxh"
 #include "MoviePlayer_bt601_limited.fxh"
@@ -16,6 +17,7 @@ bool vulkan = false;
 IDXGISwapChain *d3d11SwapChain;
 ID3D11Device* d3d11Device;
 ID3D11DeviceContext* d3d11DeviceContext;
+ID3D10Multithread* d3d11Multithread;
 
 ID3D11VertexShader* shader_vs;
 ID3D11PixelShader* shader_bt601_full;
@@ -199,6 +201,38 @@ struct FFmpegPlayer {
     Texture* game_texture;
     ID3D11RenderTargetView* render_target;
 
+    // Frames are decoded ahead of the presentation time on a separate thread, so that slow frames
+    // and packet bursts don't land on the game's frame time. The task only picks from the queue.
+    static constexpr size_t FRAME_QUEUE_SIZE = 4;
+
+    std::thread decode_thread;
+    std::mutex queue_mutex;
+    std::condition_variable queue_cond;
+    std::deque<AVFrame*> frame_queue;
+    // Frames are unreferenced and reused instead of being freed, so once the pool has grown to
+    // the queue size, playback runs without allocating any frames or packets.
+    std::vector<AVFrame*> frame_pool;
+    uint32_t frame_allocs;
+    uint32_t frames_decoded;
+    // Time spent inside the decoder, leaving out waits for queue space, so that
+    // frames_decoded / decode_time is the throughput the decoder could sustain.
+    std::chrono::steady_clock::duration decode_time;
+    // Time spent converting software frames into the staging texture on the game thread.
+    uint32_t frames_uploaded;
+    std::chrono::steady_clock::duration upload_time;
+    bool decode_stop;
+    bool decode_eof;
+    bool decode_error;
+    bool seek_pending;
+    double seek_position;
+
+    // Software decoders get buffers whose luma rows line up with the mapped staging texture,
+    // which turns the luma upload into a single contiguous copy. Zero until the first upload.
+    std::atomic<uint32_t> upload_pitch;
+    std::mutex buffer_mutex;
+    AVBufferPool* buffer_pools[3];
+    size_t buffer_sizes[3];
+
     FFmpegPlayer() {
         this->input_ctx = nullptr;
         this->decoder_ctx = nullptr;
@@ -220,9 +254,203 @@ struct FFmpegPlayer {
         this->status = Status::NotInitialized;
         this->shader = Shader::BT709_FULL;
         this->frame_updated = false;
+        this->decode_stop = false;
+        this->decode_eof = false;
+        this->decode_error = false;
+        this->seek_pending = false;
+        this->seek_position = 0.0;
+        this->frame_allocs = 0;
+        this->frames_decoded = 0;
+        this->decode_time = {};
+        this->frames_uploaded = 0;
+        this->upload_time = {};
+        this->upload_pitch = 0;
+        for (int32_t i = 0; i < 3; i++) {
+            this->buffer_pools[i] = nullptr;
+            this->buffer_sizes[i] = 0;
+        }
+    }
+
+    ~FFmpegPlayer() {
+        // Only reached when the process exits, at which point the thread is already gone.
+        if (this->decode_thread.joinable()) this->decode_thread.detach();
+    }
+
+    void StartDecoding() {
+        this->decode_stop = false;
+        this->decode_eof = false;
+        this->decode_error = false;
+        this->decode_thread = std::thread(&FFmpegPlayer::DecodeLoop, this);
+    }
+
+    void StopDecoding() {
+        if (this->decode_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(this->queue_mutex);
+                this->decode_stop = true;
+            }
+            this->queue_cond.notify_all();
+            this->decode_thread.join();
+        }
+
+        this->ClearQueue();
+        this->seek_pending = false;
+    }
+
+    void RequestSeek(double position) {
+        {
+            std::lock_guard<std::mutex> lock(this->queue_mutex);
+            this->ClearQueue();
+            this->seek_pending = true;
+            this->seek_position = position;
+            this->decode_eof = false;
+        }
+        this->queue_cond.notify_all();
+    }
+
+    // Moves to the newest queued frame whose presentation time has come. Returns false if the decoder failed.
+    bool PresentFrame() {
+        {
+            std::lock_guard<std::mutex> lock(this->queue_mutex);
+            if (this->decode_error) return false;
+
+            while (!this->frame_queue.empty() && this->position >= this->next_frame) {
+                if (this->frame != nullptr) this->ReleaseFrame(this->frame);
+                this->frame = this->frame_queue.front();
+                this->frame_queue.pop_front();
+
+                this->next_frame = this->GetFrameEnd(this->frame);
+                this->frame_updated = true;
+            }
+        }
+        this->queue_cond.notify_all();
+
+        return true;
+    }
+
+    // Time in seconds at which the frame ends and the one after it is due.
+    double GetFrameEnd(const AVFrame* frame) {
+        int64_t pts = frame->pts != AV_NOPTS_VALUE ? frame->pts : frame->best_effort_timestamp;
+        return ((double)frame->duration + (double)pts) * av_q2d(this->video->time_base);
+    }
+
+    // The functions below expect queue_mutex to be held while the decode thread is running.
+    AVFrame* AcquireFrame() {
+        if (this->frame_pool.empty()) {
+            this->frame_allocs++;
+            return av_frame_alloc();
+        }
+
+        AVFrame* frame = this->frame_pool.back();
+        this->frame_pool.pop_back();
+        return frame;
+    }
+
+    void ReleaseFrame(AVFrame* frame) {
+        av_frame_unref(frame);
+        this->frame_pool.push_back(frame);
+    }
+
+    void ClearQueue() {
+        for (AVFrame* frame : this->frame_queue) this->ReleaseFrame(frame);
+        this->frame_queue.clear();
+    }
+
+    int32_t DecodeFrame(AVPacket* packet, AVFrame* frame, bool& draining) {
+        while (true) {
+            int32_t res = avcodec_receive_frame(this->decoder_ctx, frame);
+            if (res != AVERROR(EAGAIN)) return res;
+
+            res = av_read_frame(this->input_ctx, packet);
+            if (res == AVERROR_EOF && !draining) {
+                draining = true;
+                avcodec_send_packet(this->decoder_ctx, nullptr);
+                continue;
+            }
+            if (res < 0) return res;
+
+            if (packet->stream_index != this->stream_index) {
+                av_packet_unref(packet);
+                continue;
+            }
+
+            res = avcodec_send_packet(this->decoder_ctx, packet);
+            av_packet_unref(packet);
+            if (res < 0 && res != AVERROR(EAGAIN)) return res;
+        }
+    }
+
+    void DecodeLoop() {
+        AVPacket* packet = av_packet_alloc();
+        bool draining = false;
+        // Seeking lands on the keyframe before the target, the frames up to the target are decoded but not shown.
+        bool skipping = false;
+        double skip_until = 0.0;
+
+        while (true) {
+            bool seek = false;
+            double position = 0.0;
+            {
+                std::unique_lock<std::mutex> lock(this->queue_mutex);
+                this->queue_cond.wait(lock, [this] {
+                    return this->decode_stop || this->seek_pending ||
+                        (!this->decode_eof && !this->decode_error && this->frame_queue.size() < FRAME_QUEUE_SIZE);
+                });
+
+                if (this->decode_stop) break;
+
+                seek = this->seek_pending;
+                position = this->seek_position;
+                this->seek_pending = false;
+            }
+
+            if (seek) {
+                int64_t timestamp = (int64_t)(position / av_q2d(this->video->time_base));
+                avformat_seek_file(this->input_ctx, this->stream_index, 0, timestamp, timestamp, 0);
+                avcodec_flush_buffers(this->decoder_ctx);
+                draining = false;
+                skipping = true;
+                skip_until = position;
+                continue;
+            }
+
+            AVFrame* frame;
+            {
+                std::lock_guard<std::mutex> lock(this->queue_mutex);
+                frame = this->AcquireFrame();
+            }
+
+            auto decode_start = std::chrono::steady_clock::now();
+            int32_t res = this->DecodeFrame(packet, frame, draining);
+            auto decode_end = std::chrono::steady_clock::now();
+
+            std::lock_guard<std::mutex> lock(this->queue_mutex);
+            this->decode_time += decode_end - decode_start;
+            if (this->seek_pending || res < 0) this->ReleaseFrame(frame);
+            if (this->seek_pending) continue;
+
+            if (res == 0 && skipping) {
+                if (this->GetFrameEnd(frame) < skip_until) {
+                    this->ReleaseFrame(frame);
+                    continue;
+                }
+                skipping = false;
+            }
+
+            if (res == 0) {
+                this->frame_queue.push_back(frame);
+                this->frames_decoded++;
+            }
+            else if (res == AVERROR_EOF) this->decode_eof = true;
+            else this->decode_error = true;
+        }
+
+        av_packet_free(&packet);
     }
 
     void Reset() {
+        this->StopDecoding();
+
         if (vulkan && this->decoder_ctx != nullptr && this->decoder_ctx->hw_device_ctx != nullptr) {
             AVHWDeviceContext* hw_device_ctx = (AVHWDeviceContext*)this->decoder_ctx->hw_device_ctx->data;
             AVVulkanDeviceContext* vk_device_ctx = (AVVulkanDeviceContext*)hw_device_ctx->hwctx;
@@ -241,10 +469,32 @@ struct FFmpegPlayer {
             avcodec_free_context(&this->decoder_ctx);
             this->decoder_ctx = nullptr;
         }
+        // Pools only go away once the frames still holding their buffers are freed.
+        for (int32_t i = 0; i < 3; i++) {
+            av_buffer_pool_uninit(&this->buffer_pools[i]);
+            this->buffer_sizes[i] = 0;
+        }
+        this->upload_pitch = 0;
         if (this->frame != nullptr) {
             av_frame_free(&this->frame);
             this->frame = nullptr;
         }
+        for (AVFrame* frame : this->frame_pool) av_frame_free(&frame);
+        this->frame_pool.clear();
+        if (this->frames_decoded != 0) {
+            double decode_ms = std::chrono::duration<double, std::milli>(this->decode_time).count();
+            LOG("Movie player decoded %u frames in %.1f ms (%.1f fps) using %u frame allocations",
+                this->frames_decoded, decode_ms, decode_ms > 0.0 ? this->frames_decoded * 1000.0 / decode_ms : 0.0, this->frame_allocs)
+        }
+        if (this->frames_uploaded != 0) {
+            double upload_ms = std::chrono::duration<double, std::milli>(this->upload_time).count();
+            LOG("Movie player converted %u frames in %.1f ms (%.2f ms per frame)", this->frames_uploaded, upload_ms, upload_ms / this->frames_uploaded)
+        }
+        this->frame_allocs = 0;
+        this->frames_decoded = 0;
+        this->decode_time = {};
+        this->frames_uploaded = 0;
+        this->upload_time = {};
         if (this->game_texture != nullptr) {
             TextureRelease(this->game_texture);
             this->game_texture = nullptr;
@@ -358,6 +608,80 @@ get_format(AVCodecContext* decoder_ctx, const AVPixelFormat* pixel_formats) {
     else return AV_PIX_FMT_NONE;
 }
 
+int32_t
+get_buffer(AVCodecContext* decoder_ctx, AVFrame* frame, int32_t flags) {
+    auto player = (FFmpegPlayer*)decoder_ctx->opaque;
+    uint32_t pitch = player->upload_pitch;
+
+    int32_t bytes_per_sample = 0;
+    if (frame->format == AV_PIX_FMT_YUV420P) bytes_per_sample = 1;
+    else if (frame->format == AV_PIX_FMT_YUV420P10LE) bytes_per_sample = 2;
+
+    if (pitch == 0 || bytes_per_sample == 0 || (decoder_ctx->codec->capabilities & AV_CODEC_CAP_DR1) == 0)
+        return avcodec_default_get_buffer2(decoder_ctx, frame, flags);
+
+    // The decoder may write past the visible size, up to its aligned dimensions.
+    int32_t width = frame->width;
+    int32_t height = frame->height;
+    int32_t linesize_align[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(decoder_ctx, &width, &height, linesize_align);
+
+    int32_t linesizes[3] = { (int32_t)pitch, (int32_t)pitch / 2, (int32_t)pitch / 2 };
+    int32_t widths[3] = { width, (width + 1) / 2, (width + 1) / 2 };
+    int32_t heights[3] = { height, (height + 1) / 2, (height + 1) / 2 };
+    for (int32_t i = 0; i < 3; i++) {
+        if (linesizes[i] < widths[i] * bytes_per_sample || linesizes[i] % linesize_align[i] != 0)
+            return avcodec_default_get_buffer2(decoder_ctx, frame, flags);
+    }
+
+    std::lock_guard<std::mutex> lock(player->buffer_mutex);
+    for (int32_t i = 0; i < 3; i++) {
+        // Same padding as FFmpeg's own allocator, for SIMD reads past the last row.
+        size_t size = (size_t)linesizes[i] * heights[i] + 16 + 64 - 1;
+        if (player->buffer_pools[i] == nullptr || player->buffer_sizes[i] != size) {
+            av_buffer_pool_uninit(&player->buffer_pools[i]);
+            player->buffer_pools[i] = av_buffer_pool_init(size, nullptr);
+            player->buffer_sizes[i] = size;
+        }
+
+        frame->buf[i] = player->buffer_pools[i] != nullptr ? av_buffer_pool_get(player->buffer_pools[i]) : nullptr;
+        if (frame->buf[i] == nullptr) {
+            for (int32_t j = 0; j < i; j++) av_buffer_unref(&frame->buf[j]);
+            return AVERROR(ENOMEM);
+        }
+
+        frame->data[i] = frame->buf[i]->data;
+        frame->linesize[i] = linesizes[i];
+    }
+    frame->extended_data = frame->data;
+
+    return 0;
+}
+
+// Cores left to the game's own threads when the thread count is picked automatically.
+constexpr uint32_t RESERVED_GAME_THREADS = 2;
+constexpr uint32_t MAX_DECODE_THREADS = 16;
+
+int32_t
+get_decode_thread_count() {
+    if (Config::movieDecodeThreads != 0) return (int32_t)std::min(Config::movieDecodeThreads, MAX_DECODE_THREADS);
+
+    uint32_t cores = std::thread::hardware_concurrency();
+    if (cores <= RESERVED_GAME_THREADS) return 1;
+    return (int32_t)std::min(cores - RESERVED_GAME_THREADS, MAX_DECODE_THREADS);
+}
+
+// Lock shared by FFmpeg's D3D11VA decoder and the game thread, the same one a protected context takes on every call.
+void
+d3d11_lock(void* ctx) {
+    ((ID3D10Multithread*)ctx)->Enter();
+}
+
+void
+d3d11_unlock(void* ctx) {
+    ((ID3D10Multithread*)ctx)->Leave();
+}
+
 HOOK(TaskMovie*, __fastcall, TaskMovieInit, 0x140454660, TaskMovie* movie) {
     movie->is_ffmpeg = false;
     return originalTaskMovieInit(movie);
@@ -431,6 +755,11 @@ HOOK(bool, __fastcall, TaskMovieCtrl, 0x140454890, TaskMovie* movie) {
         player->decoder_ctx->get_format = get_format;
 
         if (config == nullptr) {
+            // No hardware decoder for this codec, so spread software decoding over frame and slice threads.
+            player->decoder_ctx->thread_count = get_decode_thread_count();
+            player->decoder_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+            player->decoder_ctx->opaque = player;
+            player->decoder_ctx->get_buffer2 = get_buffer;
         }
         else if (vulkan) {
             AVBufferRef* hw_device_ctx = av_hwdevice_ctx_alloc(AV_HWDEVICE_TYPE_VULKAN);
@@ -485,8 +814,26 @@ HOOK(bool, __fastcall, TaskMovieCtrl, 0x140454890, TaskMovie* movie) {
                 break;
             }
 
+            // The decode thread shares the game's immediate context, which isn't thread safe by itself.
+            // Protecting it makes every call take the context's lock, and handing the same lock to FFmpeg
+            // keeps its multi-call sequences from interleaving with the game's rendering.
+            if (d3d11Multithread == nullptr) {
+                HRESULT hr = d3d11DeviceContext->QueryInterface(__uuidof(ID3D10Multithread), (void**)&d3d11Multithread);
+                if (FAILED(hr)) {
+                    d3d11Multithread = nullptr;
+                    movie->state = TaskMovie::State::Shutdown;
+                    player->status = FFmpegPlayer::Status::Shutdown;
+                    break;
+                }
+
+                d3d11Multithread->SetMultithreadProtected(TRUE);
+            }
+
             d3d11va_device_ctx->device = d3d11Device;
             d3d11va_device_ctx->device_context = d3d11DeviceContext;
+            d3d11va_device_ctx->lock = d3d11_lock;
+            d3d11va_device_ctx->unlock = d3d11_unlock;
+            d3d11va_device_ctx->lock_ctx = d3d11Multithread;
             res = av_hwdevice_ctx_init(hw_device_ctx);
             if (res < 0) {
                 movie->state = TaskMovie::State::Shutdown;
@@ -497,6 +844,9 @@ HOOK(bool, __fastcall, TaskMovieCtrl, 0x140454890, TaskMovie* movie) {
             player->decoder_ctx->hw_device_ctx = av_buffer_ref(hw_device_ctx);
         }
 
+        // Queued frames hold on to their surfaces, so the decoder needs that many more.
+        if (config != nullptr) player->decoder_ctx->extra_hw_frames = FFmpegPlayer::FRAME_QUEUE_SIZE + 1;
+
         res = avcodec_open2(player->decoder_ctx, decoder, nullptr);
         if (res < 0) {
             movie->state = TaskMovie::State::Shutdown;
@@ -706,6 +1056,7 @@ HOOK(bool, __fastcall, TaskMovieCtrl, 0x140454890, TaskMovie* movie) {
 
         player->position = 0.0;
         player->next_frame = 0.0;
+        player->StartDecoding();
 
         movie->state = TaskMovie::State::Disp;
         player->status = FFmpegPlayer::Status::Playing;
@@ -714,57 +1065,11 @@ HOOK(bool, __fastcall, TaskMovieCtrl, 0x140454890, TaskMovie* movie) {
         if (movie->time == -1) break;
 
         player->position = ((double)movie->time - (double)movie->offset) / 1000.0 / 1000.0;
-        while (player->position >= player->next_frame && player->next_frame < (double)player->input_ctx->duration * av_q2d(AV_TIME_BASE_Q) && !movie->paused && !movie->wait_play) {
-            int32_t res;
+        if (movie->paused || movie->wait_play) break;
 
-            AVPacket* packet = av_packet_alloc();
-            res = av_read_frame(player->input_ctx, packet);
-            if (res < 0) {
-                av_packet_free(&packet);
-                movie->state = TaskMovie::State::Shutdown;
-                player->status = FFmpegPlayer::Status::Shutdown;
-                break;
-            }
-            if (packet->stream_index != player->stream_index) {
-                av_packet_free(&packet);
-                continue;
-            }
-
-            res = avcodec_send_packet(player->decoder_ctx, packet);
-            if (res < 0) {
-                av_packet_free(&packet);
-                if (res == AVERROR(EAGAIN)) {
-                    continue;
-                }
-                else {
-                    movie->state = TaskMovie::State::Shutdown;
-                    player->status = FFmpegPlayer::Status::Shutdown;
-                    break;
-                }
-            }
-
-            player->frame_updated = false;
-
-            if (player->frame != nullptr) av_frame_free(&player->frame);
-            player->frame = av_frame_alloc();
-            res = avcodec_receive_frame(player->decoder_ctx, player->frame);
-            if (res < 0) {
-                av_frame_free(&player->frame);
-                av_packet_free(&packet);
-                if (res == AVERROR(EAGAIN)) {
-                    continue;
-                }
-                else {
-                    movie->state = TaskMovie::State::Shutdown;
-                    player->status = FFmpegPlayer::Status::Shutdown;
-                    break;
-                }
-            }
-
-            player->frame_updated = true;
-            player->next_frame = ((double)packet->duration + (double)player->frame->pts) * av_q2d(player->video->time_base);
-
-            av_packet_free(&packet);
+        if (!player->PresentFrame()) {
+            movie->state = TaskMovie::State::Shutdown;
+            player->status = FFmpegPlayer::Status::Shutdown;
         }
     }; break;
     case FFmpegPlayer::Status::Shutdown: {
@@ -783,7 +1088,8 @@ HOOK(void, __fastcall, TaskMovieCtrlPlayer, 0x1404551B0, TaskMovie* movie) {
     double position = ((double)movie->time - (double)movie->offset) / 1000.0 / 1000.0;
     if (position < 0.0) position = 0.0;
 
-    avformat_seek_file(player->input_ctx, player->stream_index, 0, (int64_t)(position / av_q2d(player->video->time_base)), (int64_t)(position / av_q2d(player->video->time_base)), 0);
+    if (player->status == FFmpegPlayer::Status::Playing) player->RequestSeek(position);
+    else avformat_seek_file(player->input_ctx, player->stream_index, 0, (int64_t)(position / av_q2d(player->video->time_base)), (int64_t)(position / av_q2d(player->video->time_base)), 0);
     player->position = position;
     player->next_frame = 0.0;
 }
@@ -930,7 +1236,10 @@ HOOK(void, __fastcall, TaskMovieDisp, 0x1404549D0, TaskMovie* movie) {
             }
         }
         else if (player->frame->format == AV_PIX_FMT_D3D11) {
+            // The decoder may be writing the next surface of the same texture array right now.
+            d3d11_lock(d3d11Multithread);
             d3d11DeviceContext->CopySubresourceRegion(player->nv12_texture, 0, 0, 0, 0, (ID3D11Texture2D*)player->frame->data[0], (uint32_t)player->frame->data[1], nullptr);
+            d3d11_unlock(d3d11Multithread);
             d3d11DeviceContext->PSSetShaderResources(0, 1, &player->luminance_view);
             d3d11DeviceContext->PSSetShaderResources(1, 1, &player->chrominance_view);
             d3d11DeviceContext->Draw(3, 0);
@@ -939,23 +1248,12 @@ HOOK(void, __fastcall, TaskMovieDisp, 0x1404549D0, TaskMovie* movie) {
             D3D11_MAPPED_SUBRESOURCE map;
             HRESULT hr = d3d11DeviceContext->Map(player->staging_nv12_texture, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
             if (FAILED(hr)) return;
+            player->upload_pitch = map.RowPitch;
 
-            for (int i = 0; i < player->frame->height; i++)
-                memcpy((uint8_t*)map.pData + i * map.RowPitch, (uint8_t*)player->frame->data[0] + i * player->frame->linesize[0], std::min((uint32_t)player->frame->linesize[0], map.RowPitch));
-
-            const __m128i filter = _mm_set_epi8(7, 7 + 8, 6, 6 + 8, 5, 5 + 8, 4, 4 + 8, 3, 3 + 8, 2, 2 + 8, 1, 1 + 8, 0, 0 + 8);
-            for (int i = 0; i < player->frame->height / 2; i++){
-                int u_offset = i * player->frame->linesize[1];
-                int v_offset = i * player->frame->linesize[2];
-                int tex_offset = (i + player->frame->height) * map.RowPitch;
-                for (int j = 0; j < player->frame->width / 8; j++) {
-                    uint64_t u = *(uint64_t*)(player->frame->data[1] + u_offset + j * 8);
-                    uint64_t v = *(uint64_t*)(player->frame->data[2] + u_offset + j * 8);
-                    __m128i data = _mm_set_epi64x(u, v);
-                    __m128i ordered = _mm_shuffle_epi8(data, filter);
-                    _mm_store_si128((__m128i*)((uint8_t*)map.pData + tex_offset + j * 16), ordered);
-                }
-            }
+            auto upload_start = std::chrono::steady_clock::now();
+            MovieConvert::yuv420p_to_nv12(player->frame->data, player->frame->linesize, player->frame->width, player->frame->height, (uint8_t*)map.pData, map.RowPitch);
+            player->upload_time += std::chrono::steady_clock::now() - upload_start;
+            player->frames_uploaded++;
             d3d11DeviceContext->Unmap(player->staging_nv12_texture, 0);
 
             d3d11DeviceContext->PSSetShaderResources(0, 1, &player->staging_luminance_view);
@@ -966,29 +1264,12 @@ HOOK(void, __fastcall, TaskMovieDisp, 0x1404549D0, TaskMovie* movie) {
             D3D11_MAPPED_SUBRESOURCE map;
             HRESULT hr = d3d11DeviceContext->Map(player->staging_nv12_texture, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
             if (FAILED(hr)) return;
+            player->upload_pitch = map.RowPitch;
 
-            for (int i = 0; i < player->frame->height; i++) {
-                int y_offset = i * player->frame->linesize[0];
-                int tex_offset = i * map.RowPitch;
-                for (int j = 0; j < player->frame->width / 8; j++) {
-                    __m128i data = _mm_load_si128((__m128i*)(player->frame->data[0] + y_offset + j * 16));
-                    _mm_store_si128((__m128i*)((uint8_t*)map.pData + tex_offset + j * 16), _mm_slli_epi16(data, 6));
-                }
-            }
-
-            const __m128i filter = _mm_set_epi8(7, 6, 7 + 8, 6 + 8, 5, 4, 5 + 8, 4 + 8, 3, 2, 3 + 8, 2 + 8, 1, 0, 1 + 8, 0 + 8);
-            for (int i = 0; i < player->frame->height / 2; i++) {
-                int u_offset = i * player->frame->linesize[1];
-                int v_offset = i * player->frame->linesize[2];
-                int tex_offset = (i + player->frame->height) * map.RowPitch;
-                for (int j = 0; j < player->frame->width / 8; j++) {
-                    uint64_t u = *(uint64_t*)(player->frame->data[1] + u_offset + j * 8);
-                    uint64_t v = *(uint64_t*)(player->frame->data[2] + u_offset + j * 8);
-                    __m128i data = _mm_set_epi64x(u, v);
-                    __m128i ordered = _mm_shuffle_epi8(_mm_slli_epi16(data, 6), filter);
-                    _mm_store_si128((__m128i*)((uint8_t*)map.pData + tex_offset + j * 16), ordered);
-                }
-            }
+            auto upload_start = std::chrono::steady_clock::now();
+            MovieConvert::yuv420p10_to_p010(player->frame->data, player->frame->linesize, player->frame->width, player->frame->height, (uint8_t*)map.pData, map.RowPitch);
+            player->upload_time += std::chrono::steady_clock::now() - upload_start;
+            player->frames_uploaded++;
             d3d11DeviceContext->Unmap(player->staging_nv12_texture, 0);
 
             d3d11DeviceContext->PSSetShaderResources(0, 1, &player->staging_luminance_view);
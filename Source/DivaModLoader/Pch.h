@@ -11,6 +11,7 @@
 #include <Windows.h>
 #include <detours.h>
 
+#include <d3d10.h>
 #include <d3d11.h>
 #include <d3d11_3.h>
 
@@ -18,11 +19,20 @@
 #include <cstdint>
 #include <cstdio>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
+#include <functional>
+#include <future>
 #include <list>
 #include <map>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <set>
 
@@ -1,5 +1,9 @@
 #include "PvLoader.h"
+
+#include "Config.h"
+#include "ModLoader.h"
 #include "SigScan.h"
+#include "Utilities.h"
 
 SIG_SCAN
 (
@@ -11,50 +15,237 @@ SIG_SCAN
 
 HOOK(void, __fastcall, PvLoaderParseStart, sigPvLoaderParseStart());
 
-static std::vector<uint32_t> pvIdStack;
+// Byte range of every line belonging to a PV, relative to the start of the pv_db data.
+struct PvRange
+{
+    uint32_t pvId;
+    size_t begin;
+    size_t end;
+};
 
-uint32_t pvLoaderParseStartImp(const char* data, size_t length)
+static std::vector<PvRange> pvIdStack;
+
+// Data and length the game is going to parse for the current PV ID. See PvLoaderImp.asm for details.
+const char* pvLoaderParseData;
+size_t pvLoaderParseLength;
+
+static const char* pvDbData;
+static size_t pvDbLength;
+
+// Finds the next line ending, checking 16 bytes at a time.
+static size_t findLineEnd(const char* data, size_t i, const size_t length)
+{
+    const __m128i newLine = _mm_set1_epi8('\n');
+    const __m128i carriageReturn = _mm_set1_epi8('\r');
+
+    for (; length - i >= sizeof(__m128i); i += sizeof(__m128i))
+    {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, newLine), _mm_cmpeq_epi8(chunk, carriageReturn)));
+
+        if (mask != 0)
+        {
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return i + index;
+        }
+    }
+
+    while (i < length && data[i] != '\n' && data[i] != '\r')
+        i++;
+
+    return i;
+}
+
+// Parses the leading digits of a PV ID, handling 8 of them at a time. Overflow wraps around the same way as multiplying by 10 per digit.
+static uint32_t parsePvId(const char* data, size_t& i, const size_t length)
+{
+    uint32_t pvId = 0;
+
+    if (length - i >= sizeof(uint64_t))
+    {
+        uint64_t chunk;
+        memcpy(&chunk, data + i, sizeof(uint64_t));
+
+        // Non-zero bytes mark characters outside of '0'-'9'. Carries only travel towards later characters, so the first one is always exact.
+        const uint64_t nonDigits = ((chunk & 0xF0F0F0F0F0F0F0F0) ^ 0x3030303030303030) |
+            (((chunk + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) ^ 0x3030303030303030);
+
+        unsigned long count = 8;
+        if (nonDigits != 0)
+        {
+            _BitScanForward64(&count, nonDigits);
+            count /= 8;
+        }
+
+        if (count == 0)
+            return 0;
+
+        // Shift the digits to the top so that the missing ones become leading zeroes.
+        uint64_t value = (chunk & 0x0F0F0F0F0F0F0F0F) << ((8 - count) * 8);
+        value = (value * 10 + (value >> 8)) & 0x00FF00FF00FF00FF;
+        value = (value * 100 + (value >> 16)) & 0x0000FFFF0000FFFF;
+        value = (value * 10000 + (value >> 32)) & 0x00000000FFFFFFFF;
+
+        pvId = static_cast<uint32_t>(value);
+        i += count;
+
+        if (count < 8)
+            return pvId;
+    }
+
+    while (i < length && data[i] >= '0' && data[i] <= '9')
+    {
+        pvId *= 10;
+        pvId += data[i] - '0';
+        i++;
+    }
+
+    return pvId;
+}
+
+// Pops the next PV ID and limits the data the game parses to the lines of that PV.
+static uint32_t popPvRange()
+{
+    if (!pvIdStack.empty())
+    {
+        const PvRange range = pvIdStack.back();
+        pvIdStack.pop_back();
+
+        pvLoaderParseData = pvDbData + range.begin;
+        pvLoaderParseLength = range.end - range.begin;
+
+        return range.pvId;
+    }
+
+    // Restore the original data as the game might still use it after the loop.
+    pvLoaderParseData = pvDbData;
+    pvLoaderParseLength = pvDbLength;
+
+    return 0xFFFFFFFF;
+}
+
+static void scanPvDb(const char* data, size_t length, std::vector<PvRange>& ranges)
 {
+    // Entries of a PV are usually grouped together, but they don't have to be. Any lines that
+    // appear later are merged into the first range, so that each PV still gets parsed once.
+    std::unordered_map<uint32_t, size_t> rangeIndices;
+
     size_t i = 0;
     uint32_t lastPvId = 0;
+    size_t lastIndex = 0;
     while (i < length) 
     {
         // Skip whitespace at the start of line.
         while (i < length && (data[i] == '\t' || data[i] == '\n' || data[i] == '\r' || data[i] == ' '))
             i++;
 
-        if (length - i > 3 && data[i] == 'p' && data[i + 1] == 'v' && data[i + 2] == '_') 
+        const size_t lineStart = i;
+        uint32_t pvId = 0;
+
+        if (length - i > 3)
         {
-            i += 3;
+            uint32_t prefix;
+            memcpy(&prefix, data + i, sizeof(uint32_t));
 
-            uint32_t pvId = 0;
-            while(i < length && std::isdigit(data[i]))
+            if ((prefix & 0xFFFFFF) == ('p' | ('v' << 8) | ('_' << 16)))
             {
-                pvId *= 10;
-                pvId += data[i] - '0';
-                i++;
+                i += 3;
+                pvId = parsePvId(data, i, length);
             }
+        }
+
+        // Move onto the next line.
+        i = findLineEnd(data, i, length);
+
+        if (pvId == 0)
+            continue;
+
+        if (pvId != lastPvId)
+        {
+            lastPvId = pvId;
+
+            const auto result = rangeIndices.emplace(pvId, ranges.size());
+            lastIndex = result.first->second;
 
-            if (pvId != lastPvId && pvId != 0)
+            if (result.second)
             {
-                lastPvId = pvId;
-                pvIdStack.push_back(pvId);
+                ranges.push_back({ pvId, lineStart, i });
+                continue;
             }
         }
 
-        // Move onto the next line.
-        while (i < length && data[i] != '\n' && data[i] != '\r')
-            i++;
+        ranges[lastIndex].end = i;
     }
+}
 
-    if (!pvIdStack.empty())
+struct PvDbPrescan
+{
+    std::string filePath;
+    uint64_t fileSize;
+    int64_t lastWriteTime;
+    bool valid = false; // false if the file couldn't be read, which doesn't get cached
+    std::vector<PvRange> ranges;
+};
+
+static std::vector<PvDbPrescan> pvDbPrescans;
+static std::future<void> pvDbPrescanFuture;
+
+// Makes sure the cached ranges actually point to the entries in the data, as files of the same size are told apart by this.
+static bool validatePvRanges(const char* data, const size_t length, const std::vector<PvRange>& ranges)
+{
+    for (auto& range : ranges)
     {
-        uint32_t pvId = pvIdStack.back();
-        pvIdStack.pop_back();
-        return pvId;
+        if (range.begin >= range.end || range.end > length || length - range.begin <= 3 || memcmp(data + range.begin, "pv_", 3) != 0)
+            return false;
+
+        if (range.end != length && data[range.end] != '\n' && data[range.end] != '\r')
+            return false;
+
+        size_t i = range.begin + 3;
+        if (parsePvId(data, i, length) != range.pvId)
+            return false;
     }
 
-    return 0xFFFFFFFF;
+    return true;
+}
+
+// The game only gives us the data, so prescanned files are matched by their size. Files that were
+// modified since the prescan are skipped. Nothing here touches more than the lines the ranges start
+// and end at, which is what makes this cheaper than scanning.
+static bool findPvDbPrescan(const char* data, const size_t length, std::vector<PvRange>& ranges)
+{
+    // Scanning right away is no slower than waiting for the prescan to finish.
+    if (!pvDbPrescanFuture.valid() || pvDbPrescanFuture.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+
+    for (auto& prescan : pvDbPrescans)
+    {
+        if (!prescan.valid || prescan.fileSize != length)
+            continue;
+
+        std::error_code errorCode;
+        const int64_t lastWriteTime = std::filesystem::last_write_time(prescan.filePath, errorCode).time_since_epoch().count();
+
+        if (!errorCode && lastWriteTime == prescan.lastWriteTime && validatePvRanges(data, length, prescan.ranges))
+        {
+            ranges.insert(ranges.end(), prescan.ranges.begin(), prescan.ranges.end());
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint32_t pvLoaderParseStartImp(const char* data, size_t length)
+{
+    pvDbData = data;
+    pvDbLength = length;
+
+    if (!findPvDbPrescan(data, length, pvIdStack))
+        scanPvDb(data, length, pvIdStack);
+
+    return popPvRange();
 }
 
 SIG_SCAN
@@ -69,14 +260,7 @@ HOOK(void, __fastcall, PvLoaderParseLoop, sigPvLoaderParseLoop());
 
 uint32_t pvLoaderParseLoopImp()
 {
-    if (!pvIdStack.empty()) 
-    {
-        uint32_t pvId = pvIdStack.back();
-        pvIdStack.pop_back();
-        return pvId;
-    }
-    
-    return 0xFFFFFFFF;
+    return popPvRange();
 }
 
 SIG_SCAN
@@ -159,3 +343,233 @@ void PvLoader::init()
     
     WRITE_JUMP(originalPvLoaderParseLoop, implOfPvLoaderParseLoop);
 }
+
+static constexpr uint32_t PV_DB_CACHE_VERSION = 3;
+static constexpr size_t PV_RANGE_CACHE_SIZE = sizeof(uint32_t) + sizeof(uint64_t) * 2;
+
+static std::string getPvDbCacheFilePath()
+{
+    return Config::cacheDirectoryPath + "/pv_db.bin";
+}
+
+static void loadPvDbCache(std::unordered_map<std::string, PvDbPrescan>& prescans)
+{
+    FILE* file = fopen(getPvDbCacheFilePath().c_str(), "rb");
+    if (file == nullptr)
+        return;
+
+    fseek(file, 0, SEEK_END);
+    const long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    // Counts read from the file get checked against what's left of it, so a truncated
+    // or corrupted cache can't make us allocate more than the file itself holds.
+    const auto remaining = [&]
+    {
+        const long position = ftell(file);
+        return position < 0 || fileSize < position ? 0 : static_cast<size_t>(fileSize - position);
+    };
+
+    uint32_t version = 0;
+    uint32_t count = 0;
+
+    if (fread(&version, sizeof(uint32_t), 1, file) == 1 && version == PV_DB_CACHE_VERSION &&
+        fread(&count, sizeof(uint32_t), 1, file) == 1)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            PvDbPrescan prescan;
+            uint32_t pathLength = 0;
+            uint32_t rangeCount = 0;
+
+            if (fread(&pathLength, sizeof(uint32_t), 1, file) != 1 || pathLength > remaining())
+                break;
+
+            prescan.filePath.resize(pathLength);
+
+            if (fread(prescan.filePath.data(), sizeof(char), pathLength, file) != pathLength ||
+                fread(&prescan.fileSize, sizeof(uint64_t), 1, file) != 1 ||
+                fread(&prescan.lastWriteTime, sizeof(int64_t), 1, file) != 1 ||
+                fread(&rangeCount, sizeof(uint32_t), 1, file) != 1)
+            {
+                break;
+            }
+
+            if (rangeCount > remaining() / PV_RANGE_CACHE_SIZE)
+                break;
+
+            prescan.ranges.resize(rangeCount);
+
+            bool rangesRead = true;
+            for (auto& range : prescan.ranges)
+            {
+                uint64_t begin = 0;
+                uint64_t end = 0;
+
+                if (fread(&range.pvId, sizeof(uint32_t), 1, file) != 1 ||
+                    fread(&begin, sizeof(uint64_t), 1, file) != 1 ||
+                    fread(&end, sizeof(uint64_t), 1, file) != 1)
+                {
+                    rangesRead = false;
+                    break;
+                }
+
+                range.begin = static_cast<size_t>(begin);
+                range.end = static_cast<size_t>(end);
+            }
+
+            if (!rangesRead)
+                break;
+
+            prescan.valid = true;
+
+            std::string filePath = prescan.filePath;
+            prescans.emplace(std::move(filePath), std::move(prescan));
+        }
+    }
+
+    fclose(file);
+}
+
+static void savePvDbCache(const std::vector<PvDbPrescan>& prescans)
+{
+    std::error_code errorCode;
+    std::filesystem::create_directories(Config::cacheDirectoryPath, errorCode);
+
+    FILE* file = fopen(getPvDbCacheFilePath().c_str(), "wb");
+    if (file == nullptr)
+        return;
+
+    const uint32_t count = static_cast<uint32_t>(std::count_if(prescans.begin(), prescans.end(), [](const PvDbPrescan& prescan) { return prescan.valid; }));
+
+    fwrite(&PV_DB_CACHE_VERSION, sizeof(uint32_t), 1, file);
+    fwrite(&count, sizeof(uint32_t), 1, file);
+
+    for (auto& prescan : prescans)
+    {
+        // Files that couldn't be read get another try on the next launch.
+        if (!prescan.valid)
+            continue;
+
+        const uint32_t pathLength = static_cast<uint32_t>(prescan.filePath.size());
+        const uint32_t rangeCount = static_cast<uint32_t>(prescan.ranges.size());
+
+        fwrite(&pathLength, sizeof(uint32_t), 1, file);
+        fwrite(prescan.filePath.data(), sizeof(char), pathLength, file);
+        fwrite(&prescan.fileSize, sizeof(uint64_t), 1, file);
+        fwrite(&prescan.lastWriteTime, sizeof(int64_t), 1, file);
+        fwrite(&rangeCount, sizeof(uint32_t), 1, file);
+
+        // Fields get written one by one, so the padding of PvRange doesn't end up in the file.
+        for (auto& range : prescan.ranges)
+        {
+            const uint64_t begin = range.begin;
+            const uint64_t end = range.end;
+
+            fwrite(&range.pvId, sizeof(uint32_t), 1, file);
+            fwrite(&begin, sizeof(uint64_t), 1, file);
+            fwrite(&end, sizeof(uint64_t), 1, file);
+        }
+    }
+
+    fclose(file);
+}
+
+static void findPvDbFiles(const std::filesystem::path& romDirectoryPath, std::vector<std::string>& filePaths)
+{
+    std::error_code errorCode;
+
+    for (auto& entry : std::filesystem::directory_iterator(romDirectoryPath / "rom", errorCode))
+    {
+        const std::string fileName = entry.path().filename().string();
+
+        if (entry.is_regular_file(errorCode) && fileName.size() >= 9 && fileName.compare(fileName.size() - 9, 9, "pv_db.txt") == 0)
+            filePaths.push_back(entry.path().string());
+    }
+}
+
+static void prescanPvDbFile(PvDbPrescan& prescan)
+{
+    FILE* file = fopen(prescan.filePath.c_str(), "rb");
+    if (file == nullptr)
+        return;
+
+    std::vector<char> data(prescan.fileSize);
+    const size_t length = fread(data.data(), sizeof(char), data.size(), file);
+    fclose(file);
+
+    if (length != prescan.fileSize)
+        return;
+
+    scanPvDb(data.data(), length, prescan.ranges);
+    prescan.valid = true;
+}
+
+void PvLoader::preInit()
+{
+    // Collect the files on this thread, as DLL mods might change the current directory while the prescan is running.
+    std::vector<std::string> filePaths;
+
+    for (auto& modDirectoryPath : ModLoader::modDirectoryPaths)
+    {
+        const std::filesystem::path path = std::filesystem::absolute(modDirectoryPath);
+        findPvDbFiles(path, filePaths);
+
+        std::error_code errorCode;
+        for (auto& entry : std::filesystem::directory_iterator(path, errorCode))
+        {
+            if (entry.is_directory(errorCode) && entry.path().filename().string().rfind("rom_", 0) == 0)
+                findPvDbFiles(entry.path(), filePaths);
+        }
+    }
+
+    if (filePaths.empty())
+        return;
+
+    pvDbPrescanFuture = std::async(std::launch::async, [filePaths = std::move(filePaths)]
+    {
+        std::unordered_map<std::string, PvDbPrescan> cachedPrescans;
+        loadPvDbCache(cachedPrescans);
+
+        std::vector<PvDbPrescan> prescans(filePaths.size());
+        std::vector<size_t> outdatedIndices;
+
+        for (size_t i = 0; i < filePaths.size(); i++)
+        {
+            auto& prescan = prescans[i];
+
+            std::error_code errorCode;
+            prescan.filePath = filePaths[i];
+            prescan.fileSize = std::filesystem::file_size(prescan.filePath, errorCode);
+
+            if (!errorCode)
+                prescan.lastWriteTime = std::filesystem::last_write_time(prescan.filePath, errorCode).time_since_epoch().count();
+
+            if (errorCode)
+                continue;
+
+            const auto cachedPrescan = cachedPrescans.find(prescan.filePath);
+
+            if (cachedPrescan != cachedPrescans.end() &&
+                cachedPrescan->second.fileSize == prescan.fileSize &&
+                cachedPrescan->second.lastWriteTime == prescan.lastWriteTime)
+            {
+                prescan = std::move(cachedPrescan->second);
+            }
+            else
+            {
+                outdatedIndices.push_back(i);
+            }
+        }
+
+        parallelFor(outdatedIndices.size(), [&](const size_t i)
+        {
+            prescanPvDbFile(prescans[outdatedIndices[i]]);
+        });
+
+        if (!outdatedIndices.empty() || cachedPrescans.size() != prescans.size())
+            savePvDbCache(prescans);
+
+        pvDbPrescans = std::move(prescans);
+    });
+}
\ No newline at end of file
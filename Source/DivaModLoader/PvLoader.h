@@ -2,5 +2,6 @@
 
 struct PvLoader
 {
+    static void preInit();
     static void init();
 };
\ No newline at end of file
@@ -32,6 +32,13 @@ endm
 
 .code 
 
+; The game keeps the pv_db data in rdi and its length in rbx while parsing.
+; Both are replaced with the byte range of the current PV so that the game
+; doesn't have to go through the entire file for every single PV ID.
+
+?pvLoaderParseData@@3PEBDEA proto
+?pvLoaderParseLength@@3_KA proto
+
 ?originalPvLoaderParseStart@@3P6AXXZEA proto
 ?pvLoaderParseStartImp@@YAIPEBD_K@Z proto
 
@@ -44,6 +51,10 @@ endm
 	add rsp, 20h
 	popaq
 	mov r14d, eax
+	lea rdi, ?pvLoaderParseData@@3PEBDEA
+	mov rdi, [rdi]
+	lea rbx, ?pvLoaderParseLength@@3_KA
+	mov rbx, [rbx]
 	mov r13, 4325c53ef368ebh
 	ret
 
@@ -58,6 +69,10 @@ public ?implOfPvLoaderParseStart@@YAXXZ
 	call ?pvLoaderParseLoopImp@@YAIXZ
 	add rsp, 20h
 	popaq
+	lea rdi, ?pvLoaderParseData@@3PEBDEA
+	mov rdi, [rdi]
+	lea rbx, ?pvLoaderParseLength@@3_KA
+	mov rbx, [rbx]
 	cmp eax, 0FFFFFFFFh
 	jz finish
 	mov r14d, eax
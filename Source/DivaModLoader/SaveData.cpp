@@ -2,6 +2,7 @@
 
 #include "Types.h"
 #include "SigScan.h"
+#include "Utilities.h"
 
 struct Score
 {
@@ -9,6 +10,8 @@ struct Score
     INSERT_PADDING(0x132C);
 };
 
+extern uint8_t EMPTY_SCORE_DATA[];
+
 struct Module
 {
     uint8_t unknown0;
@@ -32,14 +35,524 @@ struct CstmItemEx  // used by DML save, game's own save data doesn't store custo
     CstmItem cstmItem;
 };
 
-static std::unordered_map<uint32_t, Score> scoreMap;
-static std::unordered_map<uint32_t, Module> moduleMap;
-static std::unordered_map<uint32_t, CstmItem> cstmItemMap;
+// Scores live in fixed-size chunks that never move, so pointers handed to the game stay valid.
+// PV IDs in the usual range are looked up through a directly indexed slot table.
+//
+// Scores read from the save files aren't copied in at boot. They are referenced in the decrypted
+// file buffers instead, and only copied into a slot the first time the game asks for them.
+//
+// Slots handed out for writing get a dirty bit. Those are compared against what the base file
+// holds when saving, so scores that were only looked at don't end up in the journal.
+class ScoreMap
+{
+public:
+    static constexpr size_t CHUNK_SIZE = 64;
+    static constexpr uint32_t MAX_DENSE_PV_ID = 0x100000;
+
+    Score* find(const uint32_t pvId, const bool markDirty = false)
+    {
+        uint32_t slot = findSlot(pvId);
+        if (slot == INVALID_SLOT)
+        {
+            const Score* source = findSource(pvId);
+            if (source == nullptr)
+                return nullptr;
+
+            slot = createSlot(pvId);
+            memcpy(getScore(slot), source, sizeof(Score));
+
+            // Sources are in the base file, so the copy matches it until the game writes to it.
+            baselines[slot].score = source;
+
+            setSource(pvId, nullptr);
+            --sourceCount;
+        }
+
+        if (markDirty)
+            dirtyBits[slot / CHUNK_SIZE] |= 1ull << (slot % CHUNK_SIZE);
+
+        return getScore(slot);
+    }
+
+    // Finds a score without copying it into a slot.
+    const Score* peek(const uint32_t pvId) const
+    {
+        const uint32_t slot = findSlot(pvId);
+        if (slot != INVALID_SLOT)
+            return getScore(slot);
+
+        return findSource(pvId);
+    }
+
+    // Allocates a slot for an ID that isn't in the map yet. The score is left for the caller to fill in.
+    // New scores have nothing in the base file to compare against, so they get marked dirty by default.
+    Score* create(const uint32_t pvId, const bool markDirty = true)
+    {
+        const uint32_t slot = createSlot(pvId);
+
+        if (markDirty)
+            dirtyBits[slot / CHUNK_SIZE] |= 1ull << (slot % CHUNK_SIZE);
+
+        return getScore(slot);
+    }
+
+    // Registers a score in a loaded save file buffer for an ID that isn't in the map yet.
+    // The buffer has to stay alive for as long as the map does.
+    void addSource(const uint32_t pvId, const Score* score)
+    {
+        setSource(pvId, score);
+        ++sourceCount;
+    }
+
+    // Sets what the base file holds for a score that is in a slot already. Scores in a loaded
+    // save file buffer get referenced, others are remembered by their hash.
+    void setBaseline(const uint32_t pvId, const Score& score, const bool inSaveDataBuffer)
+    {
+        const uint32_t slot = findSlot(pvId);
+        if (slot == INVALID_SLOT)
+            return;
+
+        if (inSaveDataBuffer)
+            baselines[slot] = { &score, 0 };
+        else
+            baselines[slot] = { nullptr, hashScore(score) };
+    }
+
+    size_t size() const
+    {
+        return count + sourceCount;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    std::vector<const Score*> collect() const
+    {
+        std::vector<const Score*> scores;
+        scores.reserve(size());
+
+        for (uint32_t slot = 0; slot < count; slot++)
+            scores.push_back(getScore(slot));
+
+        for (const Score* score : denseSources)
+        {
+            if (score != nullptr)
+                scores.push_back(score);
+        }
+
+        for (const auto& [pvId, score] : sparseSources)
+        {
+            if (score != nullptr)
+                scores.push_back(score);
+        }
+
+        return scores;
+    }
+
+    // Dirty scores that differ from what the base file holds.
+    std::vector<const Score*> collectDirty() const
+    {
+        std::vector<const Score*> scores;
+
+        forEachDirty([&](const uint32_t slot)
+        {
+            if (!matchesBaseline(slot))
+                scores.push_back(getScore(slot));
+        });
+
+        return scores;
+    }
+
+    // Makes the current scores the baseline, after they got written to the base file in full.
+    void clearDirty()
+    {
+        forEachDirty([&](const uint32_t slot)
+        {
+            baselines[slot] = { nullptr, hashScore(*getScore(slot)) };
+        });
+
+        std::fill(dirtyBits.begin(), dirtyBits.end(), 0);
+    }
+
+private:
+    static constexpr uint32_t INVALID_SLOT = ~0u;
+
+    // Either a score in a save file buffer, or the hash of one that isn't around anymore.
+    // Neither means the base file doesn't have the score.
+    struct Baseline
+    {
+        const Score* score;
+        uint64_t hash;
+    };
+
+    static uint64_t hashScore(const Score& score)
+    {
+        return fnv1a(&score, sizeof(Score));
+    }
+
+    Score* getScore(const uint32_t slot) const
+    {
+        return &chunks[slot / CHUNK_SIZE][slot % CHUNK_SIZE];
+    }
+
+    uint32_t findSlot(const uint32_t pvId) const
+    {
+        if (pvId < MAX_DENSE_PV_ID)
+            return pvId < denseSlots.size() ? denseSlots[pvId] - 1 : INVALID_SLOT;
+
+        const auto pair = sparseSlots.find(pvId);
+        return pair != sparseSlots.end() ? pair->second : INVALID_SLOT;
+    }
+
+    uint32_t createSlot(const uint32_t pvId)
+    {
+        if (count % CHUNK_SIZE == 0)
+        {
+            chunks.push_back(std::make_unique<Score[]>(CHUNK_SIZE));
+            dirtyBits.push_back(0);
+        }
+
+        const uint32_t slot = count++;
+        baselines.push_back({ nullptr, 0 });
+
+        if (pvId < MAX_DENSE_PV_ID)
+        {
+            if (pvId >= denseSlots.size())
+                denseSlots.resize(std::max<size_t>(pvId + 1, denseSlots.size() * 2));
+
+            denseSlots[pvId] = slot + 1;
+        }
+        else
+        {
+            sparseSlots[pvId] = slot;
+        }
+
+        return slot;
+    }
+
+    bool matchesBaseline(const uint32_t slot) const
+    {
+        const Baseline& baseline = baselines[slot];
+
+        if (baseline.score != nullptr)
+            return memcmp(getScore(slot), baseline.score, sizeof(Score)) == 0;
+
+        return baseline.hash != 0 && hashScore(*getScore(slot)) == baseline.hash;
+    }
+
+    template<typename TFunction>
+    void forEachDirty(const TFunction& function) const
+    {
+        for (size_t i = 0; i < dirtyBits.size(); i++)
+        {
+            for (uint64_t bits = dirtyBits[i]; bits != 0; bits &= bits - 1)
+            {
+                unsigned long bit;
+                _BitScanForward64(&bit, bits);
+
+                function(static_cast<uint32_t>(i * CHUNK_SIZE + bit));
+            }
+        }
+    }
+
+    const Score* findSource(const uint32_t pvId) const
+    {
+        if (pvId < MAX_DENSE_PV_ID)
+            return pvId < denseSources.size() ? denseSources[pvId] : nullptr;
+
+        const auto pair = sparseSources.find(pvId);
+        return pair != sparseSources.end() ? pair->second : nullptr;
+    }
+
+    void setSource(const uint32_t pvId, const Score* score)
+    {
+        if (pvId < MAX_DENSE_PV_ID)
+        {
+            if (pvId >= denseSources.size())
+                denseSources.resize(std::max<size_t>(pvId + 1, denseSources.size() * 2));
+
+            denseSources[pvId] = score;
+        }
+        else if (score != nullptr)
+        {
+            sparseSources[pvId] = score;
+        }
+        else
+        {
+            sparseSources.erase(pvId);
+        }
+    }
+
+    std::vector<std::unique_ptr<Score[]>> chunks;
+    uint32_t count = 0;
+    std::vector<uint32_t> denseSlots; // slot + 1, 0 if empty
+    std::unordered_map<uint32_t, uint32_t> sparseSlots;
+
+    std::vector<uint64_t> dirtyBits; // a word per chunk
+    std::vector<Baseline> baselines; // per slot
+
+    std::vector<const Score*> denseSources;
+    std::unordered_map<uint32_t, const Score*> sparseSources;
+    uint32_t sourceCount = 0;
+};
+
+static ScoreMap scoreMap;
+
+// Decrypted save files that scoreMap refers to.
+static std::vector<prj::unique_ptr<uint8_t[]>> saveDataBuffers;
+
+// Modules and customize items are only a byte or two each, so they get stored in page sized chunks
+// indexed by ID, with a bitmap telling which IDs are present. Chunks never move once allocated.
+//
+// Like scores, entries handed out for writing get a dirty bit, and are compared against
+// what the base file holds when saving.
+template<typename T>
+class DenseIdMap
+{
+public:
+    static constexpr uint32_t CHUNK_SHIFT = 12;
+    static constexpr uint32_t CHUNK_SIZE = 1 << CHUNK_SHIFT;
+    static constexpr uint32_t CHUNK_MASK = CHUNK_SIZE - 1;
+    static constexpr uint32_t MAX_DENSE_ID = 1 << 24;
+
+    T* find(const uint32_t id, const bool markDirty = false)
+    {
+        const EntryRef ref = findEntry(id, false);
+        if (ref.entry == nullptr)
+            return nullptr;
+
+        if (markDirty)
+            *ref.dirtyBits |= ref.dirtyBit;
+
+        return &ref.entry->value;
+    }
+
+    // Returns the existing value if there is one, a value initialized one otherwise.
+    // New entries have nothing in the base file to compare against, so they get marked dirty.
+    T& operator[](const uint32_t id)
+    {
+        return findEntry(id, true).entry->value;
+    }
+
+    // Adds an entry from a save file. Entries that are in the map already are kept, which is how the
+    // journal takes precedence over the base file it gets loaded before. Journal entries stay dirty,
+    // while base file entries become the baseline they get compared against.
+    void load(const uint32_t id, const T& value, const bool fromJournal)
+    {
+        EntryRef ref = findEntry(id, false);
+        if (ref.entry == nullptr)
+        {
+            ref = findEntry(id, true);
+            ref.entry->value = value;
+
+            if (!fromJournal)
+                *ref.dirtyBits &= ~ref.dirtyBit;
+        }
+
+        if (!fromJournal)
+        {
+            ref.entry->baseline = value;
+            ref.entry->hasBaseline = true;
+        }
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    std::vector<std::pair<uint32_t, T>> collect()
+    {
+        std::vector<std::pair<uint32_t, T>> values;
+        values.reserve(count);
+
+        forEach(&Chunk::present, [&](const uint32_t id, const Entry& entry)
+        {
+            values.emplace_back(id, entry.value);
+        });
+
+        for (const auto& [id, sparseEntry] : sparseEntries)
+            values.emplace_back(id, sparseEntry.entry.value);
+
+        return values;
+    }
+
+    // Dirty entries that differ from what the base file holds.
+    std::vector<std::pair<uint32_t, T>> collectDirty()
+    {
+        std::vector<std::pair<uint32_t, T>> values;
+
+        forEach(&Chunk::dirty, [&](const uint32_t id, const Entry& entry)
+        {
+            if (!entry.matchesBaseline())
+                values.emplace_back(id, entry.value);
+        });
+
+        for (const auto& [id, sparseEntry] : sparseEntries)
+        {
+            if (sparseEntry.dirty && !sparseEntry.entry.matchesBaseline())
+                values.emplace_back(id, sparseEntry.entry.value);
+        }
+
+        return values;
+    }
+
+    // Makes the current values the baseline, after they got written to the base file in full.
+    void clearDirty()
+    {
+        forEach(&Chunk::dirty, [&](const uint32_t id, Entry& entry)
+        {
+            entry.baseline = entry.value;
+            entry.hasBaseline = true;
+        });
+
+        for (auto& chunk : chunks)
+        {
+            if (chunk != nullptr)
+                std::fill(std::begin(chunk->dirty), std::end(chunk->dirty), 0);
+        }
+
+        for (auto& [id, sparseEntry] : sparseEntries)
+        {
+            if (!sparseEntry.dirty)
+                continue;
+
+            sparseEntry.entry.baseline = sparseEntry.entry.value;
+            sparseEntry.entry.hasBaseline = true;
+            sparseEntry.dirty = 0;
+        }
+    }
+
+private:
+    struct Entry
+    {
+        T value; // has to stay first, the game gets handed a pointer to it
+        T baseline;
+        bool hasBaseline;
+
+        bool matchesBaseline() const
+        {
+            return hasBaseline && memcmp(&value, &baseline, sizeof(T)) == 0;
+        }
+    };
+
+    struct Chunk
+    {
+        Entry entries[CHUNK_SIZE];
+        uint64_t present[CHUNK_SIZE / 64] {};
+        uint64_t dirty[CHUNK_SIZE / 64] {};
+    };
+
+    struct SparseEntry
+    {
+        Entry entry;
+        uint64_t dirty; // same as the chunk bitmaps, with the only bit being 1
+    };
+
+    struct EntryRef
+    {
+        Entry* entry;
+        uint64_t* dirtyBits;
+        uint64_t dirtyBit;
+    };
+
+    // Inserts a value initialized entry if there is none and inserting was requested.
+    EntryRef findEntry(const uint32_t id, const bool insert)
+    {
+        if (id >= MAX_DENSE_ID)
+        {
+            auto pair = sparseEntries.find(id);
+            if (pair == sparseEntries.end())
+            {
+                if (!insert)
+                    return {};
+
+                pair = sparseEntries.emplace(id, SparseEntry { {}, 1 }).first;
+                ++count;
+            }
+
+            return { &pair->second.entry, &pair->second.dirty, 1 };
+        }
+
+        const size_t chunkIndex = id >> CHUNK_SHIFT;
+        if (chunkIndex >= chunks.size() || chunks[chunkIndex] == nullptr)
+        {
+            if (!insert)
+                return {};
+
+            if (chunkIndex >= chunks.size())
+                chunks.resize(chunkIndex + 1);
+
+            chunks[chunkIndex] = std::make_unique<Chunk>();
+        }
+
+        Chunk& chunk = *chunks[chunkIndex];
+        const uint32_t index = id & CHUNK_MASK;
+        const uint64_t bit = 1ull << (index % 64);
+
+        if (!(chunk.present[index / 64] & bit))
+        {
+            if (!insert)
+                return {};
+
+            chunk.present[index / 64] |= bit;
+            chunk.dirty[index / 64] |= bit;
+            chunk.entries[index] = {};
+            ++count;
+        }
+
+        return { &chunk.entries[index], &chunk.dirty[index / 64], bit };
+    }
+
+    // Calls the function for every entry in the chunks that has its bit set in the given bitmap.
+    template<typename TFunction>
+    void forEach(uint64_t (Chunk::* const bitmap)[CHUNK_SIZE / 64], const TFunction& function)
+    {
+        for (size_t i = 0; i < chunks.size(); i++)
+        {
+            if (chunks[i] == nullptr)
+                continue;
+
+            Chunk& chunk = *chunks[i];
+
+            for (uint32_t j = 0; j < CHUNK_SIZE / 64; j++)
+            {
+                for (uint64_t bits = (chunk.*bitmap)[j]; bits != 0; bits &= bits - 1)
+                {
+                    unsigned long bit;
+                    _BitScanForward64(&bit, bits);
+
+                    const uint32_t index = j * 64 + bit;
+                    function(static_cast<uint32_t>(i << CHUNK_SHIFT) | index, chunk.entries[index]);
+                }
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    std::unordered_map<uint32_t, SparseEntry> sparseEntries;
+    size_t count = 0;
+};
+
+static DenseIdMap<Module> moduleMap;
+static DenseIdMap<CstmItem> cstmItemMap;
+
+// Scores that are in the base file. Scores that were never written to are left out of
+// saves, unless the base file has an older version of them that needs to be overridden.
+static std::unordered_set<uint32_t> baseScoreIds;
 
 struct SaveDataEx
 {
     static constexpr uint32_t MAX_VERSION = 1; // DO NOT INCREASE THIS ANYMORE!!! Refer to LoadSaveData for the reason why.
     static constexpr char FILE_NAME[] = "DivaModLoader.dat";
+    static constexpr char JOURNAL_FILE_NAME[] = "DivaModLoaderJournal.dat"; // same layout, only contains changed entries
 
     uint32_t version;
     uint32_t headerSize;
@@ -47,6 +560,9 @@ struct SaveDataEx
     uint32_t scoreCount;
     uint32_t moduleCount;
     uint32_t cstmItemCount;
+    uint32_t deltaScoreCount;
+    uint32_t deltaScoreSize;
+    uint32_t generation; // of the base file, which a journal has to match to be loaded
     // ...add more data in new versions as necessary
 
     Score* getScores()
@@ -64,6 +580,11 @@ struct SaveDataEx
         return reinterpret_cast<CstmItemEx*>(getModules() + moduleCount); // placed right after modules
     }
 
+    uint8_t* getDeltaScores()
+    {
+        return reinterpret_cast<uint8_t*>(getCstmItems() + cstmItemCount); // placed right after customize items
+    }
+
     // ...add more functions in new versions as necessary
 };
 
@@ -116,25 +637,134 @@ SIG_SCAN
     "xxxxxxx"
 );
 
-HOOK(void, __fastcall, LoadSaveData, sigLoadSaveData(), void* A1)
+// Delta scores only store the byte runs that differ from EMPTY_SCORE_DATA, which is most of a
+// score that only had a few difficulties played. Every score is a run count followed by runs of
+// { uint16_t offset, uint16_t length, uint8_t bytes[length] }.
+constexpr size_t SCORE_DELTA_MAX_GAP = 4; // equal bytes are cheaper than a new run header up to this
+
+static size_t encodeScoreDelta(const Score& score, uint8_t* dst)
 {
-    originalLoadSaveData(A1);
+    const auto src = reinterpret_cast<const uint8_t*>(&score);
 
-    prj::unique_ptr<uint8_t[]> data;
-    size_t dataSize = 0;
+    size_t size = sizeof(uint16_t);
+    uint16_t runCount = 0;
 
-    if (!readSaveData(SaveDataEx::FILE_NAME, data, dataSize) || dataSize < (offsetof(SaveDataEx, headerSize) + sizeof(uint32_t)))
-        return;
+    for (size_t i = 0; i < sizeof(Score);)
+    {
+        if (src[i] == EMPTY_SCORE_DATA[i])
+        {
+            ++i;
+            continue;
+        }
+
+        size_t end = i + 1;
+        for (size_t j = end; j < sizeof(Score) && j - end < SCORE_DELTA_MAX_GAP; j++)
+        {
+            if (src[j] != EMPTY_SCORE_DATA[j])
+                end = j + 1;
+        }
+
+        if (dst != nullptr)
+        {
+            const uint16_t run[] = { static_cast<uint16_t>(i), static_cast<uint16_t>(end - i) };
+            memcpy(dst + size, run, sizeof(run));
+            memcpy(dst + size + sizeof(run), src + i, end - i);
+        }
+
+        size += sizeof(uint16_t) * 2 + (end - i);
+        ++runCount;
+        i = end;
+    }
+
+    if (dst != nullptr)
+        memcpy(dst, &runCount, sizeof(uint16_t));
+
+    return size;
+}
+
+static bool decodeScoreDelta(const uint8_t*& src, const uint8_t* srcEnd, Score& score)
+{
+    memcpy(&score, EMPTY_SCORE_DATA, sizeof(Score));
+
+    uint16_t runCount;
+    if (static_cast<size_t>(srcEnd - src) < sizeof(uint16_t))
+        return false;
+
+    memcpy(&runCount, src, sizeof(uint16_t));
+    src += sizeof(uint16_t);
+
+    for (uint16_t i = 0; i < runCount; i++)
+    {
+        uint16_t run[2];
+        if (static_cast<size_t>(srcEnd - src) < sizeof(run))
+            return false;
+
+        memcpy(run, src, sizeof(run));
+        src += sizeof(run);
+
+        if (static_cast<size_t>(run[0]) + run[1] > sizeof(Score) || static_cast<size_t>(srcEnd - src) < run[1])
+            return false;
+
+        memcpy(reinterpret_cast<uint8_t*>(&score) + run[0], src, run[1]);
+        src += run[1];
+    }
+
+    return true;
+}
+
+// The game asks for a score of every PV it shows, so most of them never get anything written to them.
+static bool isEmptyScore(const Score& score)
+{
+    return memcmp(reinterpret_cast<const uint8_t*>(&score) + sizeof(score.pvId),
+        EMPTY_SCORE_DATA + sizeof(score.pvId), sizeof(Score) - sizeof(score.pvId)) == 0;
+}
+
+static SaveDataEx* readSaveDataEx(const char* fileName, prj::unique_ptr<uint8_t[]>& data, size_t& dataSize)
+{
+    if (!readSaveData(fileName, data, dataSize) || dataSize < (offsetof(SaveDataEx, headerSize) + sizeof(uint32_t)))
+        return nullptr;
 
     const auto saveData = reinterpret_cast<SaveDataEx*>(data.get());
 
     if (saveData->headerSize > dataSize)
-        return;
+        return nullptr;
+
+    return saveData;
+}
+
+// Files written by DML versions before generations have none, which is treated as 0.
+static uint32_t getSaveDataExGeneration(const SaveDataEx* saveData)
+{
+    return saveData->headerSize >= offsetof(SaveDataEx, generation) + sizeof(uint32_t) ? saveData->generation : 0;
+}
+
+// Reads an extended save data file into the maps. Entries that are already in the maps are kept,
+// which is how the journal takes precedence over the base file it gets loaded before.
+//
+// Journal entries get marked dirty, as the journal is rewritten from the dirty entries on every save.
+// Base file entries become the baseline that dirty entries get compared against.
+static void loadSaveDataEx(prj::unique_ptr<uint8_t[]>& data, const size_t dataSize, const bool isJournal)
+{
+    const auto saveData = reinterpret_cast<SaveDataEx*>(data.get());
 
     for (uint32_t i = 0; i < saveData->scoreCount; i++)
     {
         auto& score = saveData->getScores()[i];
-        scoreMap.insert(std::make_pair(score.pvId, score));
+
+        if (isJournal)
+        {
+            if (scoreMap.peek(score.pvId) == nullptr)
+                memcpy(scoreMap.create(score.pvId), &score, sizeof(Score));
+        }
+        else
+        {
+            if (scoreMap.peek(score.pvId) == nullptr)
+                scoreMap.addSource(score.pvId, &score);
+            else
+                scoreMap.setBaseline(score.pvId, score, true);
+
+            baseScoreIds.insert(score.pvId);
+        }
     }
 
     if (saveData->version >= 1)
@@ -142,7 +772,7 @@ HOOK(void, __fastcall, LoadSaveData, sigLoadSaveData(), void* A1)
         for (uint32_t i = 0; i < saveData->moduleCount; i++)
         {
             auto& module = saveData->getModules()[i];
-            moduleMap.insert(std::make_pair(module.moduleId, module.module));
+            moduleMap.load(module.moduleId, module.module, isJournal);
         }
     }
 
@@ -154,9 +784,281 @@ HOOK(void, __fastcall, LoadSaveData, sigLoadSaveData(), void* A1)
         for (uint32_t i = 0; i < saveData->cstmItemCount; i++)
         {
             auto& cstmItem = saveData->getCstmItems()[i];
-            cstmItemMap.insert(std::make_pair(cstmItem.cstmItemId, cstmItem.cstmItem));
+            cstmItemMap.load(cstmItem.cstmItemId, cstmItem.cstmItem, isJournal);
+        }
+    }
+
+    if (saveData->headerSize > offsetof(SaveDataEx, deltaScoreSize))
+    {
+        const uint8_t* src = saveData->getDeltaScores();
+        const uint8_t* dataEnd = data.get() + dataSize;
+
+        if (src <= dataEnd && saveData->deltaScoreSize <= static_cast<size_t>(dataEnd - src))
+        {
+            const uint8_t* srcEnd = src + saveData->deltaScoreSize;
+
+            Score score;
+            for (uint32_t i = 0; i < saveData->deltaScoreCount && decodeScoreDelta(src, srcEnd, score); i++)
+            {
+                if (scoreMap.peek(score.pvId) == nullptr)
+                    memcpy(scoreMap.create(score.pvId, isJournal), &score, sizeof(Score));
+
+                // Decoded scores don't stick around, so the base file ones are remembered by hash.
+                if (!isJournal)
+                {
+                    scoreMap.setBaseline(score.pvId, score, false);
+                    baseScoreIds.insert(score.pvId);
+                }
+            }
+        }
+    }
+
+    // Scores keep pointing into the buffer until they get accessed.
+    if (saveData->scoreCount != 0)
+        saveDataBuffers.push_back(std::move(data));
+}
+
+// Whether the base file holds everything that isn't in the journal.
+// Until it does, saving writes the base file in full.
+static bool saveDataExBaseValid;
+
+// Whether the last queued write had no journal, so there is nothing on disk that overrides the base file.
+static bool saveDataExJournalEmpty;
+
+// Generation of the base file the in-memory state builds on, which journals get tagged with.
+static uint32_t saveDataExGeneration;
+
+// Generation of the base file that was last written successfully, updated by the writer thread.
+// A failed base write makes the next save write the base file in full again.
+static std::atomic<uint32_t> writtenSaveDataExGeneration;
+static std::atomic<bool> saveDataExBaseWriteFailed;
+
+HOOK(void, __fastcall, LoadSaveData, sigLoadSaveData(), void* A1)
+{
+    originalLoadSaveData(A1);
+
+    prj::unique_ptr<uint8_t[]> baseData;
+    prj::unique_ptr<uint8_t[]> journalData;
+    size_t baseDataSize = 0;
+    size_t journalDataSize = 0;
+
+    const SaveDataEx* base = readSaveDataEx(SaveDataEx::FILE_NAME, baseData, baseDataSize);
+    const SaveDataEx* journal = readSaveDataEx(SaveDataEx::JOURNAL_FILE_NAME, journalData, journalDataSize);
+    const uint32_t generation = base != nullptr ? getSaveDataExGeneration(base) : 0;
+
+    // Replacing the base file and deleting the journal can't happen atomically. A crash in between,
+    // a failed delete or a save by an older DML version can leave a journal behind that belongs to
+    // an older base file, which would override newer entries. Those get told apart by the generation.
+    //
+    // The journal has to be loaded first for its entries to win.
+    const bool journalValid = journal != nullptr && generation != 0 && getSaveDataExGeneration(journal) == generation;
+
+    if (journalValid)
+        loadSaveDataEx(journalData, journalDataSize, true);
+
+    if (base != nullptr)
+        loadSaveDataEx(baseData, baseDataSize, false);
+
+    // Base files without a generation get rewritten with one before any journal gets written against them.
+    saveDataExBaseValid = generation != 0;
+    saveDataExJournalEmpty = !journalValid;
+    saveDataExGeneration = generation;
+    writtenSaveDataExGeneration = generation;
+}
+
+// Scores are written as deltas if requested. Those files can't be read by DML versions before delta scores,
+// as they would find no scores in them, so this is only used for files they don't know about.
+template<typename TScores, typename TModules, typename TCstmItems>
+static void serializeSaveDataEx(std::vector<uint8_t>& data, const TScores& scores, const TModules& modules, const TCstmItems& cstmItems, const bool deltaScores, const uint32_t generation)
+{
+    size_t deltaScoreSize = 0;
+    if (deltaScores)
+    {
+        for (const Score* score : scores)
+            deltaScoreSize += encodeScoreDelta(*score, nullptr);
+    }
+
+    const size_t scoreCount = deltaScores ? 0 : scores.size();
+
+    // Every section has a known size, so the whole file can be laid out in one allocation.
+    // The buffer can be holding an earlier file, so it gets cleared for the padding to stay zero.
+    data.assign(sizeof(SaveDataEx) +
+        scoreCount * sizeof(Score) +
+        modules.size() * sizeof(ModuleEx) +
+        cstmItems.size() * sizeof(CstmItemEx) +
+        deltaScoreSize, 0);
+
+    const auto saveData = reinterpret_cast<SaveDataEx*>(data.data());
+    saveData->version = SaveDataEx::MAX_VERSION;
+    saveData->headerSize = sizeof(SaveDataEx);
+    saveData->scoreCount = static_cast<uint32_t>(scoreCount);
+    saveData->moduleCount = static_cast<uint32_t>(modules.size());
+    saveData->cstmItemCount = static_cast<uint32_t>(cstmItems.size());
+    saveData->deltaScoreCount = static_cast<uint32_t>(scores.size() - scoreCount);
+    saveData->deltaScoreSize = static_cast<uint32_t>(deltaScoreSize);
+    saveData->generation = generation;
+
+    if (!deltaScores)
+    {
+        Score* scoreData = saveData->getScores();
+        for (const Score* score : scores)
+            memcpy(scoreData++, score, sizeof(Score));
+    }
+
+    ModuleEx* moduleData = saveData->getModules();
+    for (const auto& [moduleId, module] : modules)
+    {
+        moduleData->moduleId = moduleId;
+        moduleData->module = module;
+        ++moduleData;
+    }
+
+    CstmItemEx* cstmItemData = saveData->getCstmItems();
+    for (const auto& [cstmItemId, cstmItem] : cstmItems)
+    {
+        cstmItemData->cstmItemId = cstmItemId;
+        cstmItemData->cstmItem = cstmItem;
+        ++cstmItemData;
+    }
+
+    if (deltaScores)
+    {
+        uint8_t* deltaScoreData = saveData->getDeltaScores();
+        for (const Score* score : scores)
+            deltaScoreData += encodeScoreDelta(*score, deltaScoreData);
+    }
+}
+
+static std::vector<const Score*> collectDirtyScores()
+{
+    std::vector<const Score*> scores = scoreMap.collectDirty();
+
+    scores.erase(std::remove_if(scores.begin(), scores.end(), [](const Score* score)
+    {
+        return isEmptyScore(*score) && baseScoreIds.find(score->pvId) == baseScoreIds.end();
+    }), scores.end());
+
+    return scores;
+}
+
+// Writing the extended save data to disk happens on a background thread, so that saving doesn't
+// stall the game. Only the newest snapshot is kept if the writer falls behind.
+//
+// Files get encrypted by the game's own save writer before they are queued, so none of the game's
+// code runs on the writer thread. The only game code it reaches is operator delete when the
+// buffers and paths get freed, which the game's own file loading threads use as well.
+struct SaveDataFile
+{
+    prj::unique_ptr<uint8_t[]> data;
+    size_t dataSize = 0;
+    prj::string filePath;
+};
+
+struct SaveDataWrite
+{
+    std::unique_ptr<SaveDataFile> base;
+    std::unique_ptr<SaveDataFile> journal; // deletes the journal file if null
+    prj::string journalFilePath;
+    uint32_t generation;
+};
+
+static std::mutex saveDataWriteMutex;
+static std::condition_variable saveDataWriteCondition;
+static std::unique_ptr<SaveDataWrite> pendingSaveDataWrite;
+static bool saveDataWriting;
+
+static bool writeSaveDataFile(const SaveDataFile& saveDataFile)
+{
+    // Write to a temporary file first and swap it in afterwards,
+    // so a crash in the middle can never leave a truncated save behind.
+    const prj::string tempFilePath = saveDataFile.filePath + ".tmp";
+
+    FILE* file = fopen(tempFilePath.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+
+    const bool written = fwrite(saveDataFile.data.get(), sizeof(uint8_t), saveDataFile.dataSize, file) == saveDataFile.dataSize;
+
+    if (fclose(file) == 0 && written)
+        return MoveFileExA(tempFilePath.c_str(), saveDataFile.filePath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE;
+
+    DeleteFileA(tempFilePath.c_str());
+    return false;
+}
+
+static void saveDataWriterThread()
+{
+    while (true)
+    {
+        std::unique_ptr<SaveDataWrite> write;
+        {
+            std::unique_lock lock(saveDataWriteMutex);
+            saveDataWriteCondition.wait(lock, [] { return pendingSaveDataWrite != nullptr; });
+            write = std::move(pendingSaveDataWrite);
+            saveDataWriting = true;
+        }
+
+        if (write->base != nullptr)
+        {
+            if (writeSaveDataFile(*write->base))
+                writtenSaveDataExGeneration = write->generation;
+            else
+                saveDataExBaseWriteFailed = true;
+        }
+
+        // The journal on disk has to stay if the base file it belongs to couldn't be replaced.
+        // That includes journals queued after a failed base write, which was taken off the queue already.
+        if (write->generation == writtenSaveDataExGeneration)
+        {
+            if (write->journal != nullptr)
+                writeSaveDataFile(*write->journal);
+            else
+                DeleteFileA(write->journalFilePath.c_str());
         }
+
+        write = nullptr;
+        {
+            std::lock_guard lock(saveDataWriteMutex);
+            saveDataWriting = false;
+        }
+
+        saveDataWriteCondition.notify_all();
+    }
+}
+
+static void queueSaveDataWrite(std::unique_ptr<SaveDataWrite> write)
+{
+    static std::once_flag threadFlag;
+    std::call_once(threadFlag, [] { std::thread(saveDataWriterThread).detach(); });
+
+    {
+        std::lock_guard lock(saveDataWriteMutex);
+
+        // A newer journal only holds changes made after the pending base file was
+        // snapshotted, so the base file has to be carried over to not lose them.
+        if (pendingSaveDataWrite != nullptr && write->base == nullptr)
+            write->base = std::move(pendingSaveDataWrite->base);
+
+        pendingSaveDataWrite = std::move(write);
     }
+
+    saveDataWriteCondition.notify_all();
+}
+
+// Encrypts the data on the calling thread, which has to be the game's.
+static std::unique_ptr<SaveDataFile> createSaveDataFile(const char* fileName, const std::vector<uint8_t>& data)
+{
+    auto saveDataFile = std::make_unique<SaveDataFile>();
+
+    prj::string key;
+    getSaveDataKey(key, fileName, true);
+
+    if (!writeSaveData(key, data.data(), data.size(), saveDataFile->data, saveDataFile->dataSize))
+        return nullptr;
+
+    getSaveDataFilePath(saveDataFile->filePath, fileName);
+
+    return saveDataFile;
 }
 
 SIG_SCAN
@@ -171,69 +1073,78 @@ HOOK(void, __fastcall, SaveSaveData, sigSaveSaveData(), void* A1)
 {
     originalSaveSaveData(A1);
 
+    if (saveDataExBaseWriteFailed.exchange(false))
+        saveDataExBaseValid = false;
+
     if (scoreMap.empty() && moduleMap.empty() && cstmItemMap.empty())
         return;
 
-    std::vector<uint8_t> data(sizeof(SaveDataEx));
+    auto write = std::make_unique<SaveDataWrite>();
+    std::vector<uint8_t> data;
+    bool writeBase = !saveDataExBaseValid;
 
-    const auto saveData = reinterpret_cast<SaveDataEx*>(data.data());
-    saveData->version = SaveDataEx::MAX_VERSION;
-    saveData->headerSize = sizeof(SaveDataEx);
-    saveData->scoreCount = static_cast<uint32_t>(scoreMap.size());
-    saveData->moduleCount = static_cast<uint32_t>(moduleMap.size());
-    saveData->cstmItemCount = static_cast<uint32_t>(cstmItemMap.size());
+    // Everything gets compacted into the base file once the journal grows past a quarter of it.
+    // Old DML versions only read the base file, so they see the state as of the last compaction.
+    const size_t fullSize = scoreMap.size() * sizeof(Score) + moduleMap.size() * sizeof(ModuleEx) + cstmItemMap.size() * sizeof(CstmItemEx);
 
-    for (const auto& [pvId, score] : scoreMap)
+    // The journal is only ever read by DML versions that know about delta scores, so it can always use them.
+    if (saveDataExBaseValid)
     {
-        const size_t offset = data.size();
-        data.resize(offset + sizeof(Score));
-        memcpy(&data[offset], &score, sizeof(Score));
-    }
-
-    for (const auto& [moduleId, module] : moduleMap)
-    {
-        const size_t offset = data.size();
-        data.resize(offset + sizeof(ModuleEx));
+        const auto scores = collectDirtyScores();
+        const auto modules = moduleMap.collectDirty();
+        const auto cstmItems = cstmItemMap.collectDirty();
 
-        ModuleEx moduleEx =
+        // Entries can be written back to what the base file holds, in which case
+        // the journal only has to be deleted if the last save left one behind.
+        if (scores.empty() && modules.empty() && cstmItems.empty())
         {
-            moduleId, // moduleId
-            module // module
-        };
-        memcpy(&data[offset], &moduleEx, sizeof(ModuleEx));
+            if (saveDataExJournalEmpty)
+                return;
+        }
+        else
+        {
+            serializeSaveDataEx(data, scores, modules, cstmItems, true, saveDataExGeneration);
+
+            if (data.size() <= fullSize / 4)
+                write->journal = createSaveDataFile(SaveDataEx::JOURNAL_FILE_NAME, data);
+
+            writeBase = write->journal == nullptr;
+        }
     }
 
-    for (const auto& [cstmItemId, cstmItem] : cstmItemMap)
+    if (writeBase)
     {
-        const size_t offset = data.size();
-        data.resize(offset + sizeof(CstmItemEx));
+        std::vector<const Score*> scores = scoreMap.collect();
+        scores.erase(std::remove_if(scores.begin(), scores.end(), [](const Score* score) { return isEmptyScore(*score); }), scores.end());
 
-        CstmItemEx cstmItemEx =
-        {
-            cstmItemId,
-            cstmItem
-        };
-        memcpy(&data[offset], &cstmItemEx, sizeof(CstmItemEx));
-    }
+        // Zero is left for files without a generation.
+        const uint32_t generation = saveDataExGeneration + 1 != 0 ? saveDataExGeneration + 1 : 1;
 
-    prj::string filePath;
-    prj::string key;
+        serializeSaveDataEx(data, scores, moduleMap.collect(), cstmItemMap.collect(), false, generation);
 
-    getSaveDataFilePath(filePath, SaveDataEx::FILE_NAME);
-    getSaveDataKey(key, SaveDataEx::FILE_NAME, true);
+        write->base = createSaveDataFile(SaveDataEx::FILE_NAME, data);
+        if (write->base == nullptr)
+            return;
 
-    prj::unique_ptr<uint8_t[]> fileData;
-    size_t fileDataSize = 0;
+        saveDataExGeneration = generation;
 
-    if (!writeSaveData(key, data.data(), data.size(), fileData, fileDataSize))
-        return;
+        baseScoreIds.clear();
+        for (const Score* score : scores)
+            baseScoreIds.insert(score->pvId);
 
-    FILE* file = fopen(filePath.c_str(), "wb");
-    if (file != nullptr)
-    {
-        fwrite(fileData.get(), sizeof(uint8_t), fileDataSize, file);
-        fclose(file);
+        scoreMap.clearDirty();
+        moduleMap.clearDirty();
+        cstmItemMap.clearDirty();
+
+        saveDataExBaseValid = true;
     }
+
+    getSaveDataFilePath(write->journalFilePath, SaveDataEx::JOURNAL_FILE_NAME);
+    write->generation = saveDataExGeneration;
+
+    saveDataExJournalEmpty = write->journal == nullptr;
+
+    queueSaveDataWrite(std::move(write));
 }
 
 SIG_SCAN
@@ -283,22 +1194,20 @@ HOOK(Module*, __fastcall, FindModule, sigFindModule(), void* A1, uint32_t module
 HOOK(CstmItem*, __fastcall, FindCstmItem, sigFindCstmItem(), void* A1, uint32_t cstmItemId);
 HOOK(CstmItem*, __fastcall, FindCstmItemGallery, sigFindCstmItemGallery(), void* A1, uint32_t cstmItemId);
 
-extern uint8_t EMPTY_SCORE_DATA[];
-
 Score* findOrCreateScoreImp(void* A1, int32_t pvId)
 {
     if (pvId >= 0)
     {
-        const auto result = scoreMap.find(pvId);
-        if (result != scoreMap.end())
-            return &result->second;
+        Score* result = scoreMap.find(pvId, true);
+        if (result != nullptr)
+            return result;
     }
 
     Score* result = originalFindOrCreateScore(A1, pvId);
 
     if (result == nullptr && pvId >= 0)
     {
-        result = &scoreMap[pvId];
+        result = scoreMap.create(pvId);
         memcpy(result, EMPTY_SCORE_DATA, sizeof(Score));
         result->pvId = pvId;
     }
@@ -310,9 +1219,9 @@ Score* findScoreImp(void* A1, int32_t pvId)
 {
     if (pvId >= 0)
     {
-        const auto result = scoreMap.find(pvId);
-        if (result != scoreMap.end())
-            return &result->second;
+        Score* result = scoreMap.find(pvId);
+        if (result != nullptr)
+            return result;
     }
 
     return originalFindScore(A1, pvId);
@@ -320,9 +1229,10 @@ Score* findScoreImp(void* A1, int32_t pvId)
 
 Module* findModuleImp(void* A1, uint32_t moduleId)
 {
-    const auto pair = moduleMap.find(moduleId);
-    if (pair != moduleMap.end())
-        return &pair->second;
+    // The game writes through the same pointers it reads from,
+    // so every entry handed out counts as dirty until saving compares it.
+    if (Module* module = moduleMap.find(moduleId, true))
+        return module;
 
     Module* result = originalFindModule(A1, moduleId);
 
@@ -340,9 +1250,8 @@ Module* findModuleImp(void* A1, uint32_t moduleId)
 
 CstmItem* findCstmItemImp(void* A1, uint32_t cstmItemId)
 {
-    const auto pair = cstmItemMap.find(cstmItemId);
-    if (pair != cstmItemMap.end())
-        return &pair->second;
+    if (CstmItem* cstmItem = cstmItemMap.find(cstmItemId, true))
+        return cstmItem;
 
     CstmItem* result = originalFindCstmItem(A1, cstmItemId);
 
@@ -357,6 +1266,12 @@ CstmItem* findCstmItemImp(void* A1, uint32_t cstmItemId)
     return result;
 }
 
+void SaveData::flush()
+{
+    std::unique_lock lock(saveDataWriteMutex);
+    saveDataWriteCondition.wait(lock, [] { return pendingSaveDataWrite == nullptr && !saveDataWriting; });
+}
+
 void SaveData::init()
 {
     INSTALL_HOOK(LoadSaveData);
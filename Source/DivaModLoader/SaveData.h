@@ -3,4 +3,7 @@
 struct SaveData
 {
     static void init();
+
+    // Blocks until the extended save data queued so far is on disk.
+    static void flush();
 };
\ No newline at end of file
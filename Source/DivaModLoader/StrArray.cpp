@@ -5,17 +5,248 @@
 #include "SigScan.h"
 #include "Utilities.h"
 
-typedef std::unordered_map<int, std::string> StrByIdMap;
+// Every modded string is stored in here. Blocks never get reallocated, so the pointers
+// we give to the game stay valid for the lifetime of the process.
+class StrArena
+{
+public:
+    static constexpr size_t BLOCK_SIZE = 0x10000;
+
+    const char* allocate(const std::string_view& str)
+    {
+        const size_t size = str.size() + 1;
+
+        if (size > BLOCK_SIZE - used)
+        {
+            blocks.push_back(std::make_unique<char[]>(std::max(size, BLOCK_SIZE)));
+            used = 0;
+        }
+
+        char* dst = blocks.back().get() + used;
+        memcpy(dst, str.data(), str.size());
+        dst[str.size()] = '\0';
+
+        used += size;
+        return dst;
+    }
+
+private:
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t used = BLOCK_SIZE;
+};
+
+static StrArena strArena;
+
+// Maps IDs to arena strings. Entries are kept in an open-addressed table while loading,
+// and the longest dense run of IDs gets moved into a directly indexed array afterwards.
+class StrTable
+{
+public:
+    const char* find(const int id) const
+    {
+        const size_t index = static_cast<size_t>(static_cast<int64_t>(id) - denseBase);
+        if (index < dense.size() && dense[index] != nullptr)
+            return dense[index];
+
+        if (count == 0)
+            return nullptr;
+
+        for (size_t i = hash(id);; i = (i + 1) & (slots.size() - 1))
+        {
+            const auto& slot = slots[i];
+
+            if (slot.str == nullptr)
+                return nullptr;
+
+            if (slot.id == id)
+                return slot.str;
+        }
+    }
+
+    // The first string inserted for an ID wins, same as the game's own str_array.
+    void insert(const int id, const std::string_view& str)
+    {
+        if (find(id) != nullptr)
+            return;
+
+        const size_t index = static_cast<size_t>(static_cast<int64_t>(id) - denseBase);
+        if (index < dense.size())
+        {
+            dense[index] = strArena.allocate(str);
+            return;
+        }
+
+        if ((count + 1) * 4 > slots.size() * 3)
+            rehash(std::max<size_t>(16, slots.size() * 2));
+
+        insertSlot(id, strArena.allocate(str));
+    }
+
+    // Moves the largest run of IDs that covers at least half of its ID range into the direct array.
+    // IDs outside of the run, like the large ones some mods pick, stay in the hash table.
+    void optimize()
+    {
+        std::vector<Slot> entries;
+        entries.reserve(count + dense.size());
+
+        for (size_t i = 0; i < dense.size(); i++)
+        {
+            if (dense[i] != nullptr)
+                entries.push_back({ static_cast<int>(denseBase + static_cast<int64_t>(i)), dense[i] });
+        }
+
+        for (auto& slot : slots)
+        {
+            if (slot.str != nullptr)
+                entries.push_back(slot);
+        }
+
+        if (entries.empty())
+            return;
+
+        std::sort(entries.begin(), entries.end(), [](const Slot& lhs, const Slot& rhs) { return lhs.id < rhs.id; });
+
+        // The run from i to j is dense enough if id[j] - id[i] + 1 <= (j - i + 1) * 2, which comes down to
+        // key(j) <= key(i) + 1. Only starts with a higher key than every start before them can begin the
+        // longest run, and walking the ends backwards pairs each of them with the furthest end that fits.
+        const auto key = [&](const size_t i) { return static_cast<int64_t>(entries[i].id) - static_cast<int64_t>(i) * 2; };
+
+        std::vector<size_t> starts;
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (starts.empty() || key(i) > key(starts.back()))
+                starts.push_back(i);
+        }
+
+        size_t first = 0;
+        size_t last = 0;
+
+        for (size_t j = entries.size(); j-- > 0 && !starts.empty();)
+        {
+            while (!starts.empty() && key(j) <= key(starts.back()) + 1)
+            {
+                if (j - starts.back() > last - first)
+                {
+                    first = starts.back();
+                    last = j;
+                }
+
+                starts.pop_back();
+            }
+        }
+
+        const int64_t min = entries[first].id;
+        std::vector<const char*> newDense(static_cast<size_t>(entries[last].id - min + 1));
+
+        for (size_t i = first; i <= last; i++)
+            newDense[static_cast<size_t>(entries[i].id - min)] = entries[i].str;
+
+        dense = std::move(newDense);
+        denseBase = min;
 
-static StrByIdMap strMap;
-static StrByIdMap moduleStrMap;
-static StrByIdMap customizeStrMap;
-static StrByIdMap btnSeStrMap;
-static StrByIdMap slideSeStrMap;
-static StrByIdMap chainSlideSeStrMap;
-static StrByIdMap sliderTouchSeStrMap;
+        const size_t outlierCount = entries.size() - (last - first + 1);
+        size_t capacity = 16;
+        while (outlierCount * 4 > capacity * 3)
+            capacity *= 2;
 
-static void readStrArray(const toml::table* table, StrByIdMap& dstStrMap)
+        slots.clear();
+        count = 0;
+
+        if (outlierCount == 0)
+            return;
+
+        slots.resize(capacity);
+
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (i < first || i > last)
+                insertSlot(entries[i].id, entries[i].str);
+        }
+    }
+
+private:
+    struct Slot
+    {
+        int id;
+        const char* str;
+    };
+
+    std::vector<const char*> dense;
+    int64_t denseBase = 0;
+
+    std::vector<Slot> slots;
+    size_t count = 0;
+
+    size_t hash(const int id) const
+    {
+        return (static_cast<uint32_t>(id) * 0x9E3779B9u) & (slots.size() - 1);
+    }
+
+    void insertSlot(const int id, const char* str)
+    {
+        size_t i = hash(id);
+        while (slots[i].str != nullptr)
+            i = (i + 1) & (slots.size() - 1);
+
+        slots[i] = { id, str };
+        count++;
+    }
+
+    void rehash(const size_t capacity)
+    {
+        std::vector<Slot> oldSlots(capacity);
+        std::swap(slots, oldSlots);
+        count = 0;
+
+        for (auto& slot : oldSlots)
+        {
+            if (slot.str != nullptr)
+                insertSlot(slot.id, slot.str);
+        }
+    }
+};
+
+static StrTable strMap;
+static StrTable moduleStrMap;
+static StrTable customizeStrMap;
+static StrTable btnSeStrMap;
+static StrTable slideSeStrMap;
+static StrTable chainSlideSeStrMap;
+static StrTable sliderTouchSeStrMap;
+
+enum class StrTableType : uint8_t
+{
+    Str,
+    Module,
+    Customize,
+    BtnSe,
+    SlideSe,
+    ChainSlideSe,
+    SliderTouchSe,
+    Count
+};
+
+static StrTable* const strTables[] =
+{
+    &strMap,
+    &moduleStrMap,
+    &customizeStrMap,
+    &btnSeStrMap,
+    &slideSeStrMap,
+    &chainSlideSeStrMap,
+    &sliderTouchSeStrMap
+};
+
+// Entries are kept in the order they were read in, so that inserting them
+// later results in the same strings winning as inserting them directly.
+struct StrArrayEntry
+{
+    StrTableType type;
+    int id;
+    std::string_view str;
+};
+
+static void readStrArray(const toml::table* table, StrTableType type, std::vector<StrArrayEntry>& entries)
 {
     if (!table)
         return;
@@ -29,25 +260,659 @@ static void readStrArray(const toml::table* table, StrByIdMap& dstStrMap)
         char* end = nullptr;
         const int id = strtol(key.data(), &end, 10);
 
-        if (end && dstStrMap.find(id) == dstStrMap.end())
-            dstStrMap.insert({ id, value.value_or("YOU FORGOT QUOTATION MARKS") });
+        if (end)
+            entries.push_back({ type, id, value.value_or(std::string_view("YOU FORGOT QUOTATION MARKS")) });
     }
 }
 
-static void readStrArray(const toml::table* table, const toml::table* langTable, StrByIdMap& dstStrMap)
+static void readStrArray(const toml::table* table, const toml::table* langTable, StrTableType type, std::vector<StrArrayEntry>& entries)
 {
     if (langTable != nullptr)
-        readStrArray(langTable, dstStrMap);
+        readStrArray(langTable, type, entries);
 
-    readStrArray(table, dstStrMap);
+    readStrArray(table, type, entries);
 }
 
-static void readStrArray(const toml::table* table, const toml::table* langTable, const char* name, StrByIdMap& dstStrMap)
+static void readStrArray(const toml::table* table, const toml::table* langTable, const char* name, StrTableType type, std::vector<StrArrayEntry>& entries)
 {
     if (langTable != nullptr)
-        readStrArray(langTable->get_as<toml::table>(name), dstStrMap);
+        readStrArray(langTable->get_as<toml::table>(name), type, entries);
+
+    readStrArray(table->get_as<toml::table>(name), type, entries);
+}
+
+static void insertStrArray(const std::vector<StrArrayEntry>& entries)
+{
+    for (auto& entry : entries)
+        strTables[static_cast<size_t>(entry.type)]->insert(entry.id, entry.str);
+}
+
+// Parser for the subset of TOML that mod string arrays are written in. Only entries of the
+// global table and the current language are kept, without building a DOM. It gives up on
+// anything outside of this subset (or anything invalid), in which case the file gets parsed
+// by toml++ instead, which also takes care of reporting the errors.
+class StrArrayParser
+{
+public:
+    StrArrayParser(const char* data, const size_t length, const std::string_view& language)
+        : data(data), length(length), language(language)
+    {
+    }
+
+    bool parse(std::vector<StrArrayEntry>& entries)
+    {
+        if (length >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0)
+            pos = 3;
+
+        if (!validateUtf8())
+            return false;
+
+        std::vector<std::string_view> tableParts;
+        std::vector<std::string_view> keyParts;
+
+        while (true)
+        {
+            skipWhitespace();
+
+            if (pos >= length)
+                break;
+
+            if (data[pos] == '[')
+            {
+                pos++;
+
+                if (pos < length && data[pos] == '[') // Arrays of tables
+                    return false;
+
+                tableParts.clear();
+                if (!parseKey(tableParts))
+                    return false;
+
+                skipWhitespace();
+                if (pos >= length || data[pos] != ']')
+                    return false;
+
+                pos++;
+
+                uint64_t hash = FNV1A_SEED;
+                for (auto& part : tableParts)
+                {
+                    hash = hashKeyPart(hash, part);
+                    headerTableHashes.push_back(hash);
+                }
+
+                headerTableHashes.pop_back();
+                headerHashes.push_back(hash);
+            }
+            else if (data[pos] != '\n' && data[pos] != '\r' && data[pos] != '#')
+            {
+                keyParts.assign(tableParts.begin(), tableParts.end());
+                if (!parseKey(keyParts))
+                    return false;
+
+                skipWhitespace();
+                if (pos >= length || data[pos] != '=')
+                    return false;
+
+                pos++;
+                skipWhitespace();
+
+                std::string_view value;
+                if (!parseString(value))
+                    return false;
+
+                uint64_t hash = FNV1A_SEED;
+                for (size_t i = 0; i < keyParts.size(); i++)
+                {
+                    hash = hashKeyPart(hash, keyParts[i]);
+
+                    if (i >= tableParts.size() && i + 1 < keyParts.size())
+                        dottedTableHashes.push_back(hash);
+                }
+
+                valueHashes.push_back(hash);
+                addEntry(keyParts, value);
+            }
+
+            if (!parseLineEnd())
+                return false;
+        }
+
+        if (!validateKeys())
+            return false;
+
+        // Emit the entries in the same order as traversing the toml++ tables would.
+        for (auto& bucket : buckets)
+        {
+            std::sort(bucket.begin(), bucket.end(), [](const Entry& lhs, const Entry& rhs) { return lhs.key < rhs.key; });
+
+            for (auto& entry : bucket)
+                entries.push_back({ entry.type, entry.id, entry.str });
+        }
+
+        return true;
+    }
+
+private:
+    struct Group
+    {
+        std::string_view name;
+        StrTableType type;
+    };
+
+    static constexpr Group GROUPS[] =
+    {
+        { "", StrTableType::Str },
+        { "module", StrTableType::Module },
+        { "customize", StrTableType::Customize },
+        { "cstm_item", StrTableType::Customize },
+        { "btn_se", StrTableType::BtnSe },
+        { "slide_se", StrTableType::SlideSe },
+        { "chainslide_se", StrTableType::ChainSlideSe },
+        { "slidertouch_se", StrTableType::SliderTouchSe },
+    };
+
+    struct Entry
+    {
+        std::string_view key;
+        StrTableType type;
+        int id;
+        std::string_view str;
+    };
+
+    const char* data;
+    size_t length;
+    std::string_view language;
+    size_t pos = 0;
+
+    // Every group has a bucket for the language table followed by one for the global table.
+    std::vector<Entry> buckets[_countof(GROUPS) * 2];
+
+    // Unescaped strings. Deque elements don't move, so views into them stay valid.
+    std::deque<std::string> storage;
+
+    // Used to detect redefinitions, which are errors that toml++ should report.
+    std::vector<uint64_t> valueHashes;
+    std::vector<uint64_t> dottedTableHashes; // Tables created by dotted keys
+    std::vector<uint64_t> headerTableHashes; // Tables created by [a.b] headers on the way to the last part
+    std::vector<uint64_t> headerHashes;
+
+    static uint64_t hashKeyPart(const uint64_t hash, const std::string_view& part)
+    {
+        // Separator, can't appear in valid UTF-8.
+        constexpr uint8_t SEPARATOR = 0xFF;
+
+        return fnv1a(&SEPARATOR, sizeof(SEPARATOR), fnv1a(part.data(), part.size(), hash));
+    }
+
+    bool validateUtf8() const
+    {
+        for (size_t i = pos; i < length;)
+        {
+            const uint8_t c = static_cast<uint8_t>(data[i]);
+
+            if (c < 0x80)
+            {
+                i++;
+                continue;
+            }
+
+            size_t count;
+            uint32_t codePoint;
+            uint32_t minCodePoint;
+
+            if ((c & 0xE0) == 0xC0)
+            {
+                count = 1;
+                codePoint = c & 0x1F;
+                minCodePoint = 0x80;
+            }
+            else if ((c & 0xF0) == 0xE0)
+            {
+                count = 2;
+                codePoint = c & 0x0F;
+                minCodePoint = 0x800;
+            }
+            else if ((c & 0xF8) == 0xF0)
+            {
+                count = 3;
+                codePoint = c & 0x07;
+                minCodePoint = 0x10000;
+            }
+            else
+            {
+                return false;
+            }
+
+            if (length - i <= count)
+                return false;
+
+            for (size_t j = 1; j <= count; j++)
+            {
+                const uint8_t next = static_cast<uint8_t>(data[i + j]);
+                if ((next & 0xC0) != 0x80)
+                    return false;
+
+                codePoint = (codePoint << 6) | (next & 0x3F);
+            }
+
+            if (codePoint < minCodePoint || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+                return false;
+
+            i += count + 1;
+        }
+
+        return true;
+    }
+
+    static bool isControl(const char c)
+    {
+        return (static_cast<uint8_t>(c) < 0x20 && c != '\t') || c == 0x7F;
+    }
+
+    void skipWhitespace()
+    {
+        while (pos < length && (data[pos] == ' ' || data[pos] == '\t'))
+            pos++;
+    }
+
+    bool parseLineEnd()
+    {
+        skipWhitespace();
+
+        if (pos < length && data[pos] == '#')
+        {
+            for (pos++; pos < length && data[pos] != '\n' && data[pos] != '\r'; pos++)
+            {
+                if (isControl(data[pos]))
+                    return false;
+            }
+        }
+
+        if (pos >= length)
+            return true;
+
+        if (data[pos] == '\r')
+        {
+            pos++;
+            if (pos >= length || data[pos] != '\n')
+                return false;
+        }
+
+        if (data[pos] != '\n')
+            return false;
+
+        pos++;
+        return true;
+    }
+
+    bool parseKey(std::vector<std::string_view>& parts)
+    {
+        while (true)
+        {
+            skipWhitespace();
+
+            if (pos >= length)
+                return false;
+
+            std::string_view part;
+
+            if (data[pos] == '"' || data[pos] == '\'')
+            {
+                if (!parseString(part))
+                    return false;
+            }
+            else
+            {
+                const size_t start = pos;
+
+                while (pos < length && (isalnum(static_cast<uint8_t>(data[pos])) || data[pos] == '_' || data[pos] == '-'))
+                    pos++;
+
+                if (pos == start)
+                    return false;
+
+                part = std::string_view(data + start, pos - start);
+            }
+
+            parts.push_back(part);
+            skipWhitespace();
 
-    readStrArray(table->get_as<toml::table>(name), dstStrMap);
+            if (pos >= length || data[pos] != '.')
+                return true;
+
+            pos++;
+        }
+    }
+
+    bool parseString(std::string_view& value)
+    {
+        if (pos >= length || (data[pos] != '"' && data[pos] != '\''))
+            return false;
+
+        const char quote = data[pos];
+
+        // Multi-line strings
+        if (length - pos >= 3 && data[pos + 1] == quote && data[pos + 2] == quote)
+            return false;
+
+        const size_t start = ++pos;
+        std::string* unescaped = nullptr;
+
+        while (true)
+        {
+            if (pos >= length || isControl(data[pos]))
+                return false;
+
+            const char c = data[pos];
+
+            if (c == quote)
+                break;
+
+            if (c == '\\' && quote == '"')
+            {
+                if (unescaped == nullptr)
+                    unescaped = &storage.emplace_back(data + start, pos - start);
+
+                if (!parseEscape(*unescaped))
+                    return false;
+
+                continue;
+            }
+
+            if (unescaped != nullptr)
+                unescaped->push_back(c);
+
+            pos++;
+        }
+
+        value = unescaped != nullptr ? std::string_view(*unescaped) : std::string_view(data + start, pos - start);
+        pos++;
+
+        return true;
+    }
+
+    bool parseEscape(std::string& dst)
+    {
+        pos++;
+
+        if (pos >= length)
+            return false;
+
+        const char c = data[pos++];
+
+        switch (c)
+        {
+        case 'b': dst.push_back('\b'); return true;
+        case 't': dst.push_back('\t'); return true;
+        case 'n': dst.push_back('\n'); return true;
+        case 'f': dst.push_back('\f'); return true;
+        case 'r': dst.push_back('\r'); return true;
+        case '"': dst.push_back('"'); return true;
+        case '\\': dst.push_back('\\'); return true;
+        case 'u':
+        case 'U':
+            break;
+        default:
+            return false;
+        }
+
+        const size_t digitCount = c == 'u' ? 4 : 8;
+        if (length - pos < digitCount)
+            return false;
+
+        uint32_t codePoint = 0;
+        for (size_t i = 0; i < digitCount; i++)
+        {
+            const char digit = data[pos++];
+
+            codePoint <<= 4;
+
+            if (digit >= '0' && digit <= '9')
+                codePoint |= digit - '0';
+            else if (digit >= 'a' && digit <= 'f')
+                codePoint |= digit - 'a' + 10;
+            else if (digit >= 'A' && digit <= 'F')
+                codePoint |= digit - 'A' + 10;
+            else
+                return false;
+        }
+
+        if (codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+            return false;
+
+        if (codePoint < 0x80)
+        {
+            dst.push_back(static_cast<char>(codePoint));
+        }
+        else if (codePoint < 0x800)
+        {
+            dst.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+            dst.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else if (codePoint < 0x10000)
+        {
+            dst.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+            dst.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+            dst.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else
+        {
+            dst.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+            dst.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+            dst.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+            dst.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+
+        return true;
+    }
+
+    void addEntry(const std::vector<std::string_view>& parts, const std::string_view& value)
+    {
+        // Tables of other languages, and tables nested deeper than groups are skipped, same as in readStrArray.
+        const bool isLang = parts.size() > 1 && parts[0] == language;
+        const size_t first = isLang ? 1 : 0;
+        const size_t count = parts.size() - first;
+
+        size_t group = 0;
+
+        if (count == 2)
+        {
+            for (group = 1; group < _countof(GROUPS) && GROUPS[group].name != parts[first]; group++)
+                ;
+
+            if (group == _countof(GROUPS))
+                return;
+        }
+        else if (count != 1)
+        {
+            return;
+        }
+
+        const std::string key(parts.back());
+
+        // Convert to integer the same way as readStrArray.
+        char* end = nullptr;
+        const int id = strtol(key.c_str(), &end, 10);
+
+        if (end)
+            buckets[group * 2 + (isLang ? 0 : 1)].push_back({ parts.back(), GROUPS[group].type, id, value });
+    }
+
+    static bool intersects(const std::vector<uint64_t>& lhs, const std::vector<uint64_t>& rhs)
+    {
+        for (auto left = lhs.begin(), right = rhs.begin(); left != lhs.end() && right != rhs.end();)
+        {
+            if (*left == *right)
+                return true;
+
+            if (*left < *right)
+                ++left;
+            else
+                ++right;
+        }
+
+        return false;
+    }
+
+    bool validateKeys()
+    {
+        for (auto hashes : { &valueHashes, &dottedTableHashes, &headerTableHashes, &headerHashes })
+            std::sort(hashes->begin(), hashes->end());
+
+        return std::adjacent_find(valueHashes.begin(), valueHashes.end()) == valueHashes.end() &&
+            std::adjacent_find(headerHashes.begin(), headerHashes.end()) == headerHashes.end() &&
+            !intersects(valueHashes, dottedTableHashes) &&
+            !intersects(valueHashes, headerTableHashes) &&
+            !intersects(valueHashes, headerHashes) &&
+            !intersects(headerHashes, dottedTableHashes);
+    }
+};
+
+// Mod string arrays get compiled into a binary file per language, so that they
+// don't have to be parsed again until the source file changes.
+struct StrArrayCacheHeader
+{
+    static constexpr uint32_t VERSION = 1;
+
+    uint32_t version;
+    uint32_t entryCount;
+    uint64_t sourceSize;
+    int64_t sourceWriteTime;
+    char language[16];
+    // StrArrayCacheEntry entries[entryCount];
+    // char strings[];
+};
+
+struct StrArrayCacheEntry
+{
+    StrTableType type;
+    uint8_t padding[3]; // always zero, so that the same entries always produce the same file
+    int32_t id;
+    uint32_t offset;
+    uint32_t length;
+};
+
+static std::string getStrArrayCacheFilePath(const std::string& filePath, const std::string& language)
+{
+    const std::string absolutePath = std::filesystem::absolute(filePath).lexically_normal().string();
+
+    const uint64_t hash = fnv1a(absolutePath.data(), absolutePath.size());
+
+    char fileName[0x40];
+    sprintf(fileName, "%016llx_%s.bin", static_cast<unsigned long long>(hash), language.c_str());
+
+    return Config::cacheDirectoryPath + "/str_array/" + fileName;
+}
+
+// Each mod's string array goes through here. Source files get looked up in the background during
+// init, then compiled concurrently once the game asks for its string arrays. Only files whose cache
+// is outdated get read. Entries point into the storage of this struct until they get merged into the tables.
+struct StrArrayFile
+{
+    std::string filePath;
+    bool exists = false;
+    StrArrayCacheHeader header{};
+    std::string source;
+    std::string cacheStrings;
+    toml::table table;
+    std::vector<StrArrayEntry> entries;
+    std::string errorText;
+};
+
+static std::vector<StrArrayFile> strArrayFiles;
+static std::future<void> strArrayQueryFuture;
+
+static bool loadStrArrayCache(const std::string& cacheFilePath, StrArrayFile& file)
+{
+    const HANDLE handle = CreateFileA(cacheFilePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    const HANDLE mapping = GetFileSizeEx(handle, &fileSize) && static_cast<uint64_t>(fileSize.QuadPart) >= sizeof(StrArrayCacheHeader) ?
+        CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+
+    CloseHandle(handle);
+
+    if (mapping == nullptr)
+        return false;
+
+    const auto data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    CloseHandle(mapping);
+
+    if (data == nullptr)
+        return false;
+
+    const auto header = reinterpret_cast<const StrArrayCacheHeader*>(data);
+    const auto entries = reinterpret_cast<const StrArrayCacheEntry*>(header + 1);
+    const auto strings = reinterpret_cast<const char*>(entries + header->entryCount);
+    const size_t payloadSize = static_cast<size_t>(fileSize.QuadPart) - sizeof(StrArrayCacheHeader);
+
+    bool valid = header->version == StrArrayCacheHeader::VERSION &&
+        header->sourceSize == file.header.sourceSize &&
+        header->sourceWriteTime == file.header.sourceWriteTime &&
+        strncmp(header->language, file.header.language, sizeof(header->language)) == 0 &&
+        header->entryCount <= payloadSize / sizeof(StrArrayCacheEntry);
+
+    if (valid)
+    {
+        const size_t stringsSize = payloadSize - header->entryCount * sizeof(StrArrayCacheEntry);
+
+        for (uint32_t i = 0; i < header->entryCount && valid; i++)
+            valid = entries[i].type < StrTableType::Count && entries[i].offset <= stringsSize && entries[i].length <= stringsSize - entries[i].offset;
+
+        if (valid)
+        {
+            // The view gets unmapped below, so the strings need their own copy.
+            file.cacheStrings.assign(strings, stringsSize);
+            file.entries.reserve(header->entryCount);
+
+            for (uint32_t i = 0; i < header->entryCount; i++)
+                file.entries.push_back({ entries[i].type, entries[i].id, std::string_view(file.cacheStrings.data() + entries[i].offset, entries[i].length) });
+        }
+    }
+
+    UnmapViewOfFile(data);
+    return valid;
+}
+
+static void saveStrArrayCache(const std::string& cacheFilePath, StrArrayCacheHeader header, const std::vector<StrArrayEntry>& entries)
+{
+    std::error_code errorCode;
+    std::filesystem::create_directories(std::filesystem::path(cacheFilePath).parent_path(), errorCode);
+
+    // Files get compiled on worker threads, and two mod entries can resolve to the same cache file.
+    // Each writer gets its own temporary file, which then gets swapped in whole.
+    char tempSuffix[0x20];
+    sprintf(tempSuffix, ".%lu.tmp", GetCurrentThreadId());
+
+    const std::string tempFilePath = cacheFilePath + tempSuffix;
+
+    FILE* file = fopen(tempFilePath.c_str(), "wb");
+    if (file == nullptr)
+        return;
+
+    header.entryCount = static_cast<uint32_t>(entries.size());
+
+    std::vector<StrArrayCacheEntry> cacheEntries;
+    cacheEntries.reserve(entries.size());
+
+    uint32_t offset = 0;
+    for (auto& entry : entries)
+    {
+        cacheEntries.push_back({ entry.type, {}, entry.id, offset, static_cast<uint32_t>(entry.str.size()) });
+        offset += static_cast<uint32_t>(entry.str.size());
+    }
+
+    bool written = fwrite(&header, sizeof(StrArrayCacheHeader), 1, file) == 1 &&
+        fwrite(cacheEntries.data(), sizeof(StrArrayCacheEntry), cacheEntries.size(), file) == cacheEntries.size();
+
+    for (auto& entry : entries)
+        written &= fwrite(entry.str.data(), sizeof(char), entry.str.size(), file) == entry.str.size();
+
+    if (fclose(file) != 0 || !written || !MoveFileExA(tempFilePath.c_str(), cacheFilePath.c_str(), MOVEFILE_REPLACE_EXISTING))
+        DeleteFileA(tempFilePath.c_str());
 }
 
 SIG_SCAN
@@ -58,49 +923,148 @@ SIG_SCAN
     "xxxxxxxxxxxxx????xxxxxxxxx"
 );
 
-static void loadStrArray(const std::string& filePath)
+// Only gets the size and write time, which is all that's needed to find out if the cache is still valid.
+static void queryStrArrayFile(StrArrayFile& file)
 {
-    if (!std::filesystem::exists(filePath))
+    std::error_code errorCode;
+    file.exists = std::filesystem::is_regular_file(file.filePath, errorCode);
+
+    if (!file.exists)
         return;
 
-    toml::table table;
+    file.header.version = StrArrayCacheHeader::VERSION;
+    file.header.sourceSize = std::filesystem::file_size(file.filePath, errorCode);
+
+    // A failed query returns -1, which must not end up as the buffer size.
+    if (errorCode)
+    {
+        file.exists = false;
+        file.errorText = "Failed to read \"" + std::filesystem::path(file.filePath).lexically_normal().string() + "\".";
+        return;
+    }
+
+    file.header.sourceWriteTime = std::filesystem::last_write_time(file.filePath, errorCode).time_since_epoch().count();
+}
+
+static bool readStrArraySource(StrArrayFile& file)
+{
+    FILE* handle = fopen(file.filePath.c_str(), "rb");
+    if (handle == nullptr)
+    {
+        file.errorText = "Failed to read \"" + std::filesystem::path(file.filePath).lexically_normal().string() + "\".";
+        return false;
+    }
+
+    file.source.resize(static_cast<size_t>(file.header.sourceSize));
+    file.source.resize(fread(file.source.data(), sizeof(char), file.source.size(), handle));
+    fclose(handle);
+
+    return true;
+}
+
+// Runs on worker threads, so nothing in here may touch the string tables or show UI.
+static void compileStrArrayFile(StrArrayFile& file, const char* language)
+{
+    if (!file.exists)
+        return;
+
+    strncpy(file.header.language, language, sizeof(file.header.language) - 1);
+
+    const std::string cacheFilePath = getStrArrayCacheFilePath(file.filePath, file.header.language);
+
+    if (loadStrArrayCache(cacheFilePath, file) || !readStrArraySource(file))
+        return;
+
+    StrArrayParser parser(file.source.data(), file.source.size(), language);
+
+    if (parser.parse(file.entries))
+    {
+        saveStrArrayCache(cacheFilePath, file.header, file.entries);
+        return;
+    }
+
+    file.entries.clear();
 
     try
     {
-        table = toml::parse_file(filePath);
+        file.table = toml::parse(file.source, file.filePath);
     }
     catch (std::exception& exception)
     {
         char text[0x400];
         sprintf(text, "Failed to parse \"%s\".\nDid you forget to add quotation marks to your string?\n\nDetails:\n%s",
-            std::filesystem::path(filePath).lexically_normal().string().c_str(), exception.what());
-
-        LOG("%s", text)
-        MessageBoxA(nullptr, text, "DIVA Mod Loader", MB_ICONERROR);
+            std::filesystem::path(file.filePath).lexically_normal().string().c_str(), exception.what());
 
+        file.errorText = text;
         return;
     }
 
-    FUNCTION_PTR(const char*, __fastcall, getLangDir, readInstrPtr(sigLoadStrArray(), 0x55, 0x5));
+    toml::table* langTable = file.table.get_as<toml::table>(language);
 
-    toml::table* langTable = table.get_as<toml::table>(strstr(getLangDir(), "/") + 1);
+    readStrArray(&file.table, langTable, StrTableType::Str, file.entries);
+    readStrArray(&file.table, langTable, "module", StrTableType::Module, file.entries);
+    readStrArray(&file.table, langTable, "customize", StrTableType::Customize, file.entries);
+    readStrArray(&file.table, langTable, "cstm_item", StrTableType::Customize, file.entries);
+    readStrArray(&file.table, langTable, "btn_se", StrTableType::BtnSe, file.entries);
+    readStrArray(&file.table, langTable, "slide_se", StrTableType::SlideSe, file.entries);
+    readStrArray(&file.table, langTable, "chainslide_se", StrTableType::ChainSlideSe, file.entries);
+    readStrArray(&file.table, langTable, "slidertouch_se", StrTableType::SliderTouchSe, file.entries);
 
-    readStrArray(&table, langTable, strMap);
-    readStrArray(&table, langTable, "module", moduleStrMap);
-    readStrArray(&table, langTable, "customize", customizeStrMap);
-    readStrArray(&table, langTable, "cstm_item", customizeStrMap);
-    readStrArray(&table, langTable, "btn_se", btnSeStrMap);
-    readStrArray(&table, langTable, "slide_se", slideSeStrMap);
-    readStrArray(&table, langTable, "chainslide_se", chainSlideSeStrMap);
-    readStrArray(&table, langTable, "slidertouch_se", sliderTouchSeStrMap);
+    saveStrArrayCache(cacheFilePath, file.header, file.entries);
 }
 
 HOOK(void, __fastcall, LoadStrArray, sigLoadStrArray())
 {
     originalLoadStrArray();
 
-    for (auto& dir : ModLoader::modDirectoryPaths)
-        loadStrArray(dir + "/rom/lang2/mod_str_array.toml");
+    // The first call picks up the files looked up during init. Later ones, like after
+    // a language change, have to look them up again.
+    if (strArrayQueryFuture.valid())
+    {
+        strArrayQueryFuture.get();
+    }
+    else
+    {
+        parallelFor(strArrayFiles.size(), [](const size_t i)
+        {
+            queryStrArrayFile(strArrayFiles[i]);
+        });
+    }
+
+    FUNCTION_PTR(const char*, __fastcall, getLangDir, readInstrPtr(sigLoadStrArray(), 0x55, 0x5));
+
+    const char* language = strstr(getLangDir(), "/") + 1;
+
+    parallelFor(strArrayFiles.size(), [&](const size_t i)
+    {
+        compileStrArrayFile(strArrayFiles[i], language);
+    });
+
+    // Merging happens in mod priority order. Tables keep the first string they get
+    // for an ID, so higher priority mods win the same way they did when loading serially.
+    for (auto& file : strArrayFiles)
+    {
+        if (!file.errorText.empty())
+        {
+            LOG("%s", file.errorText.c_str())
+            MessageBoxA(nullptr, file.errorText.c_str(), "DIVA Mod Loader", MB_ICONERROR);
+        }
+        else
+        {
+            insertStrArray(file.entries);
+        }
+    }
+
+    // Only the paths are kept around, the tables have their own copies of the strings.
+    for (auto& file : strArrayFiles)
+    {
+        std::string filePath = std::move(file.filePath);
+        file = {};
+        file.filePath = std::move(filePath);
+    }
+
+    for (auto table : strTables)
+        table->optimize();
 }
 
 SIG_SCAN
@@ -170,10 +1134,10 @@ HOOK(const char*, __fastcall, GetSliderTouchSeName, (uint8_t*)sigGetSliderTouchS
 
 const char* getStrImp(const int id)
 {
-    const auto str = strMap.find(id);
+    const char* str = strMap.find(id);
 
-    if (str != strMap.end())
-        return str->second.c_str();
+    if (str != nullptr)
+        return str;
 
     auto originalStr = originalGetStr(id);
     if (originalStr == nullptr) return originalGetStr(0);
@@ -182,66 +1146,80 @@ const char* getStrImp(const int id)
 
 const char* getModuleNameImp(const int id, const int moduleId)
 {
-    const auto str = moduleStrMap.find(moduleId);
+    const char* str = moduleStrMap.find(moduleId);
 
-    if (str != moduleStrMap.end())
-        return str->second.c_str();
+    if (str != nullptr)
+        return str;
 
     return getStrImp(id);
 }
 
 const char* getCustomizeNameImp(const int id, const int customizeId)
 {
-    const auto str = customizeStrMap.find(customizeId);
+    const char* str = customizeStrMap.find(customizeId);
 
-    if (str != customizeStrMap.end())
-        return str->second.c_str();
+    if (str != nullptr)
+        return str;
 
     return getStrImp(id);
 }
 
 const char* getBtnSeNameImp(const int id, const int btnSeId)
 {
-    const auto str = btnSeStrMap.find(btnSeId);
+    const char* str = btnSeStrMap.find(btnSeId);
 
-    if (str != btnSeStrMap.end())
-        return str->second.c_str();
+    if (str != nullptr)
+        return str;
 
     return getStrImp(id);
 }
 
 const char* getSlideSeNameImp(const int id, const int slideSeId)
 {
-    const auto str = slideSeStrMap.find(slideSeId);
+    const char* str = slideSeStrMap.find(slideSeId);
 
-    if (str != slideSeStrMap.end())
-        return str->second.c_str();
+    if (str != nullptr)
+        return str;
 
     return getStrImp(id);
 }
 
 const char* getChainSlideSeNameImp(const int id, const int chainSlideSeId)
 {
-    const auto str = chainSlideSeStrMap.find(chainSlideSeId);
+    const char* str = chainSlideSeStrMap.find(chainSlideSeId);
 
-    if (str != chainSlideSeStrMap.end())
-        return str->second.c_str();
+    if (str != nullptr)
+        return str;
 
     return getStrImp(id);
 }
 
 const char* getSliderTouchSeNameImp(const int id, const int sliderTouchSeId)
 {
-    const auto str = sliderTouchSeStrMap.find(sliderTouchSeId);
+    const char* str = sliderTouchSeStrMap.find(sliderTouchSeId);
 
-    if (str != sliderTouchSeStrMap.end())
-        return str->second.c_str();
+    if (str != nullptr)
+        return str;
 
     return getStrImp(id);
 }
 
 void StrArray::init()
 {
+    // Paths have to be absolute, as DLL mods change the current directory while the files are being looked up.
+    for (auto& dir : ModLoader::modDirectoryPaths)
+        strArrayFiles.emplace_back().filePath = std::filesystem::absolute(dir + "/rom/lang2/mod_str_array.toml").string();
+
+    // The language isn't known until the game loads its own string arrays,
+    // so only the file lookups can start this early.
+    strArrayQueryFuture = std::async(std::launch::async, []
+    {
+        parallelFor(strArrayFiles.size(), [](const size_t i)
+        {
+            queryStrArrayFile(strArrayFiles[i]);
+        });
+    });
+
     INSTALL_HOOK(LoadStrArray);
     INSTALL_HOOK(GetStr);
     WRITE_CALL(originalGetModuleName, implOfGetModuleName);
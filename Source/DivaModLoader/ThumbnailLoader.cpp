@@ -1,5 +1,6 @@
 #include "ThumbnailLoader.h"
 
+#include "Context.h"
 #include "SigScan.h"
 #include "Utilities.h"
 #include "Types.h"
@@ -101,7 +102,125 @@ static FUNCTION_PTR(SpriteInfo*, __fastcall, getSpriteInfo, sigGetSpriteInfo(),
 static FUNCTION_PTR(uint32_t*, __fastcall, getSpriteSetByIndex, sigGetSpriteSetByIndex(), void* a1, uint32_t index);
 
 constexpr uint32_t BASE_SPR_PV_TMB_ID = 4527;
-static std::set<uint32_t> pendingSets;
+
+// Upper bound for how many loading sets get polled per frame, so that requesting
+// hundreds of thumbnail sets at once doesn't make every frame slower.
+constexpr size_t MAX_SPR_SET_POLLS_PER_FRAME = 16;
+
+struct SprSetRequest
+{
+    uint32_t set;
+    std::chrono::steady_clock::time_point loadTime;
+};
+
+// Every set that is loading.
+static std::set<uint32_t> requestedSets;
+
+// Sets that are loading, oldest first.
+static std::deque<SprSetRequest> pendingSets;
+
+static void requestSprSet(const uint32_t set)
+{
+    if (!requestedSets.insert(set).second)
+        return;
+
+    string_range name;
+    loadSprSet(set, name);
+
+    pendingSets.push_back({ set, std::chrono::steady_clock::now() });
+}
+
+static void pollPendingSprSets()
+{
+    // Sets that are still loading go to the back, so the budget rotates through all of them in request order.
+    for (size_t i = std::min(pendingSets.size(), MAX_SPR_SET_POLLS_PER_FRAME); i > 0; i--)
+    {
+        const auto request = pendingSets.front();
+        pendingSets.pop_front();
+
+        if (loadSprSetFinish(request.set))
+        {
+            pendingSets.push_back(request);
+            continue;
+        }
+
+        requestedSets.erase(request.set);
+
+        LOG("Loaded sprite set %u in %.2f ms", request.set,
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - request.loadTime).count())
+    }
+}
+
+// Thumbnail sets of every PV seen so far, indexed by PV ID. IDs past MAX_DENSE_PV_ID, which mods
+// can use as PV IDs are 32-bit, go to a hash map instead. Sprite names only get formatted and
+// looked up the first time a PV shows up. The sprite database doesn't change after boot, and PVs
+// added by a pv_db reload get resolved when they first appear here.
+struct PvThumbnailSets
+{
+    bool resolved;
+    uint32_t set;
+    uint32_t setEx;
+};
+
+constexpr uint32_t MAX_DENSE_PV_ID = 0x10000;
+
+static std::vector<PvThumbnailSets> pvThumbnailSets;
+static std::unordered_map<uint32_t, PvThumbnailSets> sparsePvThumbnailSets;
+
+static bool findThumbnailSet(const char* format, const int pvId, uint32_t& set)
+{
+    char buf[256];
+    const int length = sprintf(buf, format, pvId);
+    string_range name(buf, length);
+
+    const SpriteInfo* spr = getSpriteInfo(nullptr, name);
+    if (spr->id == (uint32_t)-1)
+        return false;
+
+    set = *getSpriteSetByIndex(nullptr, spr->setIndex);
+    if (set == BASE_SPR_PV_TMB_ID)
+        set = (uint32_t)-1;
+
+    return true;
+}
+
+static PvThumbnailSets resolveThumbnailSets(const int pvId)
+{
+    PvThumbnailSets sets{ true, (uint32_t)-1, (uint32_t)-1 };
+
+    // EX thumbnails are only considered for PVs that have a regular one.
+    if (findThumbnailSet("SPR_SEL_PVTMB_%03d", pvId, sets.set) &&
+        findThumbnailSet("SPR_SEL_PVTMB_%03d_EX", pvId, sets.setEx) && sets.setEx == sets.set)
+    {
+        sets.setEx = (uint32_t)-1;
+    }
+
+    return sets;
+}
+
+static PvThumbnailSets getThumbnailSets(const int pvId)
+{
+    if (pvId < 0)
+        return resolveThumbnailSets(pvId);
+
+    if ((uint32_t)pvId >= MAX_DENSE_PV_ID)
+    {
+        auto& sets = sparsePvThumbnailSets[(uint32_t)pvId];
+        if (!sets.resolved)
+            sets = resolveThumbnailSets(pvId);
+
+        return sets;
+    }
+
+    if ((size_t)pvId >= pvThumbnailSets.size())
+        pvThumbnailSets.resize(std::min<size_t>(std::max<size_t>((size_t)pvId + 1, pvThumbnailSets.size() * 2), MAX_DENSE_PV_ID));
+
+    auto& sets = pvThumbnailSets[pvId];
+    if (!sets.resolved)
+        sets = resolveThumbnailSets(pvId);
+
+    return sets;
+}
 
 HOOK(void, __fastcall, LoadPvSpriteIds, sigLoadPvSpriteIds(), uint64_t a1)
 {
@@ -110,52 +229,19 @@ HOOK(void, __fastcall, LoadPvSpriteIds, sigLoadPvSpriteIds(), uint64_t a1)
     auto sprites = (prj::map<int, PvSpriteId> *)(a1 + 0x330);
     for (auto it = sprites->begin(); it != sprites->end(); it++)
     {
-        char buf[256];
-        int length;
-        uint32_t set;
-        uint32_t setEx;
-        SpriteInfo *spr;
-        string_range name;
-
-        length = sprintf(buf, "SPR_SEL_PVTMB_%03d", it->first);
-        name = string_range(buf, length);
-        spr = getSpriteInfo(nullptr, name);
-        if (spr->id == (uint32_t)-1)
-            continue;
+        const auto sets = getThumbnailSets(it->first);
 
-        set = *getSpriteSetByIndex(nullptr, spr->setIndex);
-        if (set != (uint32_t)-1 && set != BASE_SPR_PV_TMB_ID && pendingSets.find(set) == pendingSets.end())
-        {
-            name = string_range();
-            loadSprSet(set, name);
-            pendingSets.insert(set);
-        }
+        if (sets.set != (uint32_t)-1)
+            requestSprSet(sets.set);
 
-        length = sprintf(buf, "SPR_SEL_PVTMB_%03d_EX", it->first);
-        name = string_range(buf, length);
-        spr = getSpriteInfo(nullptr, name);
-        if (spr->id != (uint32_t)-1)
-        {
-            setEx = *getSpriteSetByIndex(nullptr, spr->setIndex);
-            if (setEx != (uint32_t)-1 && setEx != BASE_SPR_PV_TMB_ID && setEx != set && pendingSets.find(setEx) == pendingSets.end())
-            {
-                name = string_range();
-                loadSprSet(setEx, name);
-                pendingSets.insert(setEx);
-            }
-        }
+        if (sets.setEx != (uint32_t)-1)
+            requestSprSet(sets.setEx);
     }
 }
 
 HOOK(bool, __fastcall, TaskPvDbCtrl, sigTaskPvDbCtrl(), uint64_t a1) 
 {
-    for (auto it = pendingSets.begin(); it != pendingSets.end();)
-    {
-        if (loadSprSetFinish(*it) == 0)
-            it = pendingSets.erase(it);
-        else
-            it++;
-    }
+    pollPendingSprSets();
 
     return originalTaskPvDbCtrl(a1);
 }
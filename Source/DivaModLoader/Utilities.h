@@ -93,4 +93,41 @@ inline void* readInstrPtr(void* function, ptrdiff_t instrOffset, ptrdiff_t instr
 {
     uint8_t* instrAddr = (uint8_t*)function + instrOffset;
     return instrAddr + *(int32_t*)(instrAddr + instrSize - 0x4) + instrSize;
+}
+
+constexpr uint64_t FNV1A_SEED = 0xCBF29CE484222325;
+
+/// Hashes the bytes with 64-bit FNV-1a. Passing a previous result as the seed continues that hash.
+inline uint64_t fnv1a(const void* data, const size_t size, uint64_t hash = FNV1A_SEED)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= static_cast<const uint8_t*>(data)[i];
+        hash *= 0x100000001B3;
+    }
+
+    return hash;
+}
+
+/// Calls the function for every index in [0, count) on worker threads, and waits for all of them to finish.
+template<typename T>
+inline void parallelFor(const size_t count, const T& function)
+{
+    const size_t threadCount = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+
+    std::atomic<size_t> next = 0;
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount);
+
+    for (size_t i = 0; i < threadCount; i++)
+    {
+        threads.emplace_back([&]
+        {
+            for (size_t index = next++; index < count; index = next++)
+                function(index);
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
 }
\ No newline at end of file